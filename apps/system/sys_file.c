@@ -4,34 +4,336 @@
  *
  * Description: the file system server
  * Manage the disk device; Handle file (inode) read and write for other apps.
+ * Disk blocks are cached with LRU replacement, and the dirty blocks are
+ * written back in batches when one of them is evicted, and all together
+ * every CACHE_FLUSH_PERIOD requests or upon a FILE_FLUSH request, and
+ * sequential file reads make the cache read ahead with multi-block reads.
+ * Paths are resolved upon FILE_LOOKUP requests with a cache of names.
  */
 
 #include "app.h"
+#include "dir.h"
 #include "inode.h"
 
 int getsize(inode_intf bs, uint ino) { return FILE_SYS_DISK_SIZE / BLOCK_SIZE; }
 
 int setsize(inode_intf bs, uint ino, uint newsize) { FATAL("cannot set size"); }
 
+/* The I/O scheduler queues disk requests, sorts them in C-SCAN order from
+ * the current disk position, and merges the requests of adjacent blocks into
+ * one disk command through the staging buffer io_buf. */
+#define IOQ_SIZE    32
+#define IOQ_NBLOCKS DISK_MAX_NBLOCKS
+static struct io_request {
+    uint type, offset, nblocks;
+    block_t *buf, *staged;
+} ioq[IOQ_SIZE];
+static uint ioq_len, ioq_nblocks, io_position;
+static uint io_nrequest, io_ncommand, io_ndispatch, io_depth_sum, io_depth_max;
+static block_t io_buf[IOQ_NBLOCKS];
+
+static void io_dispatch() {
+    if (!ioq_len) return;
+    io_ndispatch++;
+    io_depth_sum += ioq_len;
+    io_depth_max = (ioq_len > io_depth_max) ? ioq_len : io_depth_max;
+
+    struct disk_request cmd[IOQ_SIZE];
+    uint ncmd        = 0;
+    block_t* staging = io_buf;
+    for (uint i = 0, j; i < ioq_len; i = j) {
+        /* Merge the following requests of the same type on adjacent blocks. */
+        uint nblocks = ioq[i].nblocks;
+        for (j = i + 1; j < ioq_len && ioq[j].type == ioq[i].type &&
+                        ioq[j].offset == ioq[i].offset + nblocks &&
+                        nblocks + ioq[j].nblocks <= DISK_MAX_NBLOCKS;
+             j++)
+            nblocks += ioq[j].nblocks;
+
+        block_t* buf = ioq[i].buf;
+        if (j > i + 1) {
+            buf = staging;
+            for (uint k = i; k < j; k++) {
+                ioq[k].staged = staging;
+                if (ioq[k].type == DISK_WRITE)
+                    memcpy(staging, ioq[k].buf, ioq[k].nblocks * BLOCK_SIZE);
+                staging += ioq[k].nblocks;
+            }
+        }
+
+        uint block_no = FILE_SYS_DISK_START + ioq[i].offset;
+        cmd[ncmd++]   = (struct disk_request){.type     = ioq[i].type,
+                                              .block_no = block_no,
+                                              .nblocks  = nblocks,
+                                              .buf      = buf->bytes};
+        io_position = ioq[i].offset + nblocks;
+    }
+
+    /* Submit all the commands, and let other processes run until they are
+     * completed. */
+    for (uint i = 0; i < ncmd; i++) grass->sys_disk_submit(&cmd[i]);
+    for (uint i = 0; i < ncmd; i++) grass->sys_disk_wait();
+
+    for (uint i = 0; i < ioq_len; i++)
+        if (ioq[i].staged && ioq[i].type == DISK_READ)
+            memcpy(ioq[i].buf, ioq[i].staged, ioq[i].nblocks * BLOCK_SIZE);
+    io_ncommand += ncmd;
+    ioq_len = ioq_nblocks = 0;
+}
+
+static void io_submit(uint type, uint offset, uint nblocks, block_t* buf) {
+    if (ioq_len == IOQ_SIZE || ioq_nblocks + nblocks > IOQ_NBLOCKS)
+        io_dispatch();
+
+    /* C-SCAN: serve the blocks from io_position upward, and then wrap around
+     * to the lowest block, so keep the queue sorted by the distance. */
+    uint i = ioq_len++;
+    for (; i && ioq[i - 1].offset - io_position > offset - io_position; i--)
+        ioq[i] = ioq[i - 1];
+    ioq[i] = (struct io_request){type, offset, nblocks, buf, NULL};
+    ioq_nblocks += nblocks;
+    io_nrequest++;
+}
+
+static void disk_access(uint type, uint offset, uint nblocks, block_t* buf) {
+    io_submit(type, offset, nblocks, buf);
+    io_dispatch();
+}
+
+static void io_info() {
+    uint ratio = io_nrequest * 10 / (io_ncommand ? io_ncommand : 1);
+    uint depth = io_depth_sum * 10 / (io_ndispatch ? io_ndispatch : 1);
+    INFO("sys_file: %d requests in %d disk commands (merge ratio %d.%d), "
+         "queue depth %d.%d on average and %d at most",
+         io_nrequest, io_ncommand, ratio / 10, ratio % 10, depth / 10,
+         depth % 10, io_depth_max);
+}
+
+#define CACHE_NBLOCKS      128
+#define CACHE_FLUSH_PERIOD 64
+static struct cache_block {
+    uint offset, dirty;
+    uint last_use; /* 0 if the entry is unused */
+    block_t block;
+} cache[CACHE_NBLOCKS];
+static uint cache_clock, cache_nhit, cache_nmiss, cache_nwriteback;
+
+static void cache_writeback(struct cache_block* b) {
+    io_submit(DISK_WRITE, b->offset, 1, &b->block);
+    b->dirty = 0;
+    cache_nwriteback++;
+}
+
+static struct cache_block* cache_find(uint offset) {
+    for (uint i = 0; i < CACHE_NBLOCKS; i++)
+        if (cache[i].last_use && cache[i].offset == offset) return &cache[i];
+    return NULL;
+}
+
+static void cache_writeback_from(uint offset, uint nblocks) {
+    /* Queue up to nblocks dirty blocks from offset in the order of their
+     * offsets, so the I/O scheduler merges the adjacent ones into large
+     * disk commands. */
+    for (uint n = 0; n < nblocks; n++) {
+        struct cache_block* next = NULL;
+        for (uint i = 0; i < CACHE_NBLOCKS; i++)
+            if (cache[i].dirty && cache[i].offset >= offset &&
+                (!next || cache[i].offset < next->offset))
+                next = &cache[i];
+
+        if (!next) break;
+        offset = next->offset + 1;
+        cache_writeback(next);
+    }
+    io_dispatch();
+}
+
+static void cache_flush() { cache_writeback_from(0, CACHE_NBLOCKS); }
+
+static struct cache_block* cache_alloc(uint offset) {
+    /* Replace the least recently used block, and write it back together
+     * with the dirty blocks after it, as one batch for the I/O scheduler. */
+    struct cache_block* b = cache;
+    for (uint i = 1; i < CACHE_NBLOCKS; i++)
+        if (cache[i].last_use < b->last_use) b = &cache[i];
+
+    if (b->dirty) cache_writeback_from(b->offset, IOQ_SIZE);
+    b->offset   = offset;
+    b->last_use = ++cache_clock;
+    return b;
+}
+
+static void cache_fill(uint offset, uint nblocks, block_t* buf) {
+    disk_access(DISK_READ, offset, nblocks, buf);
+    /* Add the first block last as the most recently used one. */
+    for (uint i = nblocks; i > 0; i--)
+        memcpy(&cache_alloc(offset + i - 1)->block, &buf[i - 1], BLOCK_SIZE);
+}
+
+static struct cache_block* cache_get(uint offset, uint fill) {
+    struct cache_block* b = cache_find(offset);
+    if (b) {
+        cache_nhit++;
+        b->last_use = ++cache_clock;
+        return b;
+    }
+
+    cache_nmiss++;
+    b = cache_alloc(offset);
+    if (fill) disk_access(DISK_READ, offset, 1, &b->block);
+    return b;
+}
+
 int read(inode_intf bs, uint ino, uint offset, block_t* block) {
-    earth->disk_read(FILE_SYS_DISK_START + offset, 1, block->bytes);
+    memcpy(block, &cache_get(offset, 1)->block, BLOCK_SIZE);
+    return 0;
+}
+
+int readv(inode_intf bs, uint ino, uint offset, uint nblocks,
+          block_t* blocks) {
+    for (uint i = 0; i < nblocks;) {
+        struct cache_block* b = cache_find(offset + i);
+        if (b) {
+            cache_nhit++;
+            b->last_use = ++cache_clock;
+            memcpy(&blocks[i++], &b->block, BLOCK_SIZE);
+            continue;
+        }
+
+        /* Read the run of missing blocks with one disk request. */
+        uint n = 1;
+        while (i + n < nblocks && n < DISK_MAX_NBLOCKS &&
+               !cache_find(offset + i + n))
+            n++;
+        cache_nmiss += n;
+        cache_fill(offset + i, n, &blocks[i]);
+        i += n;
+    }
     return 0;
 }
 
 int write(inode_intf bs, uint ino, uint offset, block_t* block) {
-    earth->disk_write(FILE_SYS_DISK_START + offset, 1, block->bytes);
+    /* A whole block is written, so a miss does not read the disk. */
+    struct cache_block* b = cache_get(offset, 0);
+    memcpy(&b->block, block, BLOCK_SIZE);
+    b->dirty = 1;
     return 0;
 }
 
+static inode_intf fs;
+
+static int fs_read(int ino, uint offset, char* block) {
+    return fs->read(fs, ino, offset, (void*)block);
+}
+
+/* Detect sequential reads of every file, and double its readahead window
+ * for every sequential read up to READAHEAD_MAX blocks. The file blocks in
+ * the window are read into the cache with fs->readv, which reads the runs
+ * of contiguous data blocks with one disk request each, and the metadata
+ * reads of the inode store are never read ahead. */
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 32
+static struct {
+    uint next_offset, window;
+    uint ahead; /* the file blocks before ahead have been read ahead */
+} stream[NINODES];
+static uint cache_nreadahead;
+static block_t readahead_buf[READAHEAD_MAX];
+
+static void readahead(uint ino, uint offset) {
+    if (ino >= NINODES) return;
+
+    if (offset != stream[ino].next_offset) {
+        stream[ino].window = stream[ino].ahead = 0;
+    } else {
+        uint window        = stream[ino].window * 2;
+        stream[ino].window = (window < READAHEAD_MIN)   ? READAHEAD_MIN
+                             : (window > READAHEAD_MAX) ? READAHEAD_MAX
+                                                        : window;
+    }
+    stream[ino].next_offset = offset + 1;
+
+    /* Read the window ahead again once half of it has been read. */
+    uint window = stream[ino].window, ahead = stream[ino].ahead;
+    if (!window || ahead > offset + window / 2) return;
+
+    int size   = fs->getsize(fs, ino);
+    uint start = (ahead > offset) ? ahead : offset;
+    uint end   = (size >= 0 && offset + window > size) ? size : offset + window;
+    if (start >= end) return;
+
+    inode_readv(fs, ino, start, end - start, readahead_buf);
+    cache_nreadahead += end - start;
+    stream[ino].ahead = end;
+}
+
+/* The dentry cache maps a name in a directory to its inode number, or to -1
+ * if the name is not found, and the entries of a directory are dropped when
+ * the directory is written. */
+#define DCACHE_SIZE 64
+static struct dentry {
+    int parent, ino;
+    char name[DIR_NAME_LEN]; /* empty if the entry is unused */
+} dcache[DCACHE_SIZE];
+static uint dcache_nhit, dcache_nmiss;
+
+static int dcache_lookup(int parent, char* name) {
+    struct dentry* d = &dcache[(dir_hash(name) + parent) % DCACHE_SIZE];
+    if (d->name[0] && d->parent == parent && !strcmp(d->name, name)) {
+        dcache_nhit++;
+        return d->ino;
+    }
+
+    dcache_nmiss++;
+    d->parent = parent;
+    d->ino    = dir_find(fs_read, parent, name);
+    strcpy(d->name, name);
+    return d->ino;
+}
+
+static void dcache_invalidate(int dir_ino) {
+    for (uint i = 0; i < DCACHE_SIZE; i++)
+        if (dcache[i].parent == dir_ino) dcache[i].name[0] = 0;
+}
+
+static int path_lookup(int ino, char* path) {
+    if (path[0] == '/') ino = 0;
+
+    char name[DIR_NAME_LEN];
+    while (ino >= 0 && *path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+
+        /* The name of a directory in its parent ends with a '/', so a name
+         * without it is also looked up with it. */
+        uint len = strcspn(path, "/"), dir = (path[len] == '/');
+        if (len + dir >= DIR_NAME_LEN) return -1;
+        memcpy(name, path, len + dir);
+        name[len + dir] = 0;
+
+        int parent = ino;
+        ino        = dcache_lookup(parent, name);
+        if (ino < 0 && !dir && len + 1 < DIR_NAME_LEN)
+            ino = dcache_lookup(parent, strcat(name, "/"));
+        path += len + dir;
+    }
+    return ino;
+}
+
 int main() {
     SUCCESS("Enter kernel process GPID_FILE");
 
-    /* Initialize the file system interface. */
-    struct inode_store disk = (struct inode_store){
-        .read = read, .write = write, .getsize = getsize, .setsize = setsize};
+    /* Initialize the file system interface. Multi-block writes go to the
+     * write-back cache one block at a time (see inode_writev). */
+    struct inode_store disk = (struct inode_store){.read    = read,
+                                                   .write   = write,
+                                                   .readv   = readv,
+                                                   .getsize = getsize,
+                                                   .setsize = setsize};
 
-    inode_intf fs =
-        (FILESYS == 0) ? mydisk_init(&disk, 0) : treedisk_init(&disk, 0);
+    fs = (FILESYS == 0) ? mydisk_init(&disk, 0) : treedisk_init(&disk, 0);
 
     /* Send a notification to GPID_PROCESS. */
     char buf[SYSCALL_MSG_LEN];
@@ -39,7 +341,7 @@ int main() {
     grass->sys_send(GPID_PROCESS, buf, 32);
 
     /* Wait for inode read or write requests. */
-    while (1) {
+    for (uint nrequests = 1;; nrequests++) {
         int sender, r;
         struct file_request* req = (void*)buf;
         struct file_reply* reply = (void*)buf;
@@ -47,14 +349,48 @@ int main() {
 
         switch (req->type) {
         case FILE_READ:
+            readahead(req->ino, req->offset);
             r = fs->read(fs, req->ino, req->offset, (void*)&reply->block);
             reply->status = r == 0 ? FILE_OK : FILE_ERROR;
             grass->sys_send(sender, (void*)reply, sizeof(*reply));
             break;
+        case FILE_FLUSH:
+            cache_flush();
+            INFO("sys_file: cache hit %d, miss %d, write-back %d, readahead %d",
+                 cache_nhit, cache_nmiss, cache_nwriteback, cache_nreadahead);
+            io_info();
+            INFO("sys_file: dentry cache hit %d, miss %d", dcache_nhit,
+                 dcache_nmiss);
+            reply->status = FILE_OK;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
+        case FILE_LOOKUP:
+            req->block.bytes[BLOCK_SIZE - 1] = 0;
+            r             = path_lookup(req->ino, req->block.bytes);
+            reply->ino    = r;
+            reply->status = r >= 0 ? FILE_OK : FILE_ERROR;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
         case FILE_WRITE:
-            /* The FILE_WRITE case is left to students as an exercise. */
+            /* The block stays dirty in the cache until it is written back
+             * (see file_flush), and the names cached for the inode are
+             * dropped in case it is a directory. The executable pages
+             * cached for it are dropped by GPID_PROCESS (see file_write). */
+            r = fs->write(fs, req->ino, req->offset, (void*)&req->block);
+            dcache_invalidate(req->ino);
+            reply->status = r == 0 ? FILE_OK : FILE_ERROR;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
+        case FILE_SETSIZE:
+            r = fs->setsize(fs, req->ino, req->offset);
+            dcache_invalidate(req->ino);
+            reply->status = r >= 0 ? FILE_OK : FILE_ERROR;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
         default:
             FATAL("sys_file: invalid request %d", req->type);
         }
+
+        if (nrequests % CACHE_FLUSH_PERIOD == 0) cache_flush();
     }
 }
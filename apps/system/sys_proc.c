@@ -10,6 +10,7 @@
 #include "elf.h"
 #include "disk.h"
 
+#define PAGE_SIZE 4096
 static int app_ino, app_pid;
 static void sys_spawn(uint base);
 static int app_spawn(struct proc_request* req);
@@ -30,7 +31,7 @@ int main(int unused, struct multicore* boot) {
 
     /* Student's code ends here. */
 
-    int sender, shell_waiting;
+    int sender, child, shell_waiting;
     char buf[SYSCALL_MSG_LEN];
 
     sys_spawn(SYS_TERM_EXEC_START);
@@ -46,6 +47,8 @@ int main(int unused, struct multicore* boot) {
     while (1) {
         struct proc_request* req = (void*)buf;
         struct proc_reply* reply = (void*)buf;
+        /* Zero free pages for the next spawn while waiting for requests. */
+        earth->mmu_zero_refill();
         grass->sys_recv(GPID_ALL, &sender, buf, SYSCALL_MSG_LEN);
 
         switch (req->type) {
@@ -58,6 +61,33 @@ int main(int unused, struct multicore* boot) {
                 INFO("process %d running in the background", app_pid);
             grass->sys_send(GPID_SHELL, (void*)reply, sizeof(*reply));
             break;
+        case PROC_FORK:
+            child       = grass->proc_fork(sender);
+            reply->type = (child > 0) ? CMD_OK : CMD_ERROR;
+            reply->pid  = child;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            if (child < 0) break;
+
+            reply->pid = 0;
+            grass->sys_send(child, (void*)reply, sizeof(*reply));
+            break;
+        case PROC_UNMAP:
+            /* Release heap pages freed by free() in library/libc/malloc.c. */
+            for (uint i = 0; i < req->npages; i++) {
+                uint vaddr = req->addr + i * PAGE_SIZE;
+                if (vaddr >= APPS_ENTRY && vaddr < APPS_ARG)
+                    earth->mmu_unmap(sender, vaddr / PAGE_SIZE);
+            }
+            reply->type = CMD_OK;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
+        case PROC_CACHE_DROP:
+            /* A file has been written, so the next spawn of it should not
+             * map the pages cached from its old contents. */
+            earth->mmu_cache_drop(req->ino);
+            reply->type = CMD_OK;
+            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            break;
         case PROC_EXIT:
             grass->proc_free(sender);
 
@@ -80,15 +110,20 @@ int main(int unused, struct multicore* boot) {
     }
 }
 
-static void app_read(uint off, char* dst) { file_read(app_ino, off, dst); }
+static void app_read(uint off, uint nblocks, char* dst) {
+    for (uint i = 0; i < nblocks; i++)
+        file_read(app_ino, off + i, dst + i * BLOCK_SIZE);
+}
 
 static int app_spawn(struct proc_request* req) {
-    int bin_ino = dir_lookup(0, "bin/");
-    if ((app_ino = dir_lookup(bin_ino, req->argv[0])) < 0) return CMD_ERROR;
+    char path[CMD_ARG_LEN + 8] = "/bin/";
+    if (strchr(req->argv[0], '/')) return CMD_ERROR;
+    strcat(path, req->argv[0]);
+    if ((app_ino = file_lookup(0, path)) < 0) return CMD_ERROR;
     int argc = req->argv[req->argc - 1][0] == '&' ? req->argc - 1 : req->argc;
 
     app_pid = grass->proc_alloc();
-    elf_load(app_pid, app_read, argc, (void**)req->argv);
+    elf_load(app_pid, app_read, NULL, app_ino, argc, (void**)req->argv);
     grass->proc_set_ready(app_pid);
 
     return CMD_OK;
@@ -97,8 +132,18 @@ static int app_spawn(struct proc_request* req) {
 static int sys_apps_base;
 char* sys_apps[] = {"sys_process", "sys_terminal", "sys_file", "sys_shell"};
 
-static void sys_proc_read(uint block_no, char* dst) {
-    earth->disk_read(sys_apps_base + block_no, 1, dst);
+static void sys_proc_read(uint block_no, uint nblocks, char* dst) {
+    /* elf_load() reads at most one page, i.e., 8 blocks, at a time. */
+    struct disk_request req = {.type     = DISK_READ,
+                               .block_no = sys_apps_base + block_no,
+                               .nblocks  = nblocks,
+                               .buf      = dst};
+    grass->sys_disk_submit(&req);
+    grass->sys_disk_wait();
+}
+
+static char* sys_proc_map(uint block_no) {
+    return earth->disk_map(sys_apps_base + block_no);
 }
 
 static void sys_spawn(uint base) {
@@ -106,6 +151,6 @@ static void sys_spawn(uint base) {
     INFO("Load kernel process #%d: %s", pid, sys_apps[pid - 1]);
 
     sys_apps_base = base;
-    elf_load(pid, sys_proc_read, 0, NULL);
+    elf_load(pid, sys_proc_read, sys_proc_map, -1, 0, NULL);
     grass->proc_set_ready(pid);
 }
@@ -38,6 +38,18 @@ int main() {
              * the proc_coresinfo() function in grass/process.c. */
 
             /* Student's code ends here. */
+        } else if (strcmp(buf, "meminfo") == 0) {
+            earth->mmu_info();
+        } else if (strcmp(buf, "diskinfo") == 0) {
+            earth->disk_info();
+        } else if (strcmp(buf, "shutdown") == 0) {
+            /* Write the blocks cached by GPID_FILE back to the disk, and
+             * power off QEMU with its SiFive test device. */
+            file_flush();
+            earth->disk_info();
+            if (earth->platform == QEMU) REGW(QEMU_TEST_BASE, 0) = 0x5555;
+            CRITICAL("It is now safe to turn off the board");
+            while (1);
         } else if (strcmp(buf, "killall") == 0) {
             req.type = PROC_KILLALL;
             grass->sys_send(GPID_PROCESS, (void*)&req, sizeof(req));
@@ -9,15 +9,14 @@
 
 int main(int argc, char** argv) {
     if (argc == 1) {
-        int home_ino = dir_lookup(0, "home/");
-        workdir_ino  = dir_lookup(home_ino, "yunhao/");
+        workdir_ino = file_lookup(0, "/home/yunhao/");
         strcpy(workdir, "/home/yunhao");
         return 0;
     }
 
     /* Set the inode number to the new working directory. */
     if (argv[1][strlen(argv[1]) - 1] != '/') strcat(argv[1], "/");
-    int dir_ino = dir_lookup(workdir_ino, argv[1]);
+    int dir_ino = file_lookup(workdir_ino, argv[1]);
     if (dir_ino == -1) {
         INFO("cd: directory %s not found", argv[1]);
         return -1;
@@ -28,7 +27,10 @@ int main(int argc, char** argv) {
     if (strcmp("./", argv[1]) == 0) return 0;
 
     uint len = strlen(workdir);
-    if (strcmp("../", argv[1]) == 0) {
+    if (argv[1][0] == '/') {
+        strcpy(workdir, argv[1]);
+        if (strlen(workdir) > 1) workdir[strlen(workdir) - 1] = 0;
+    } else if (strcmp("../", argv[1]) == 0) {
         while (workdir[len] != '/') workdir[len--] = 0;
         if (len) workdir[len] = 0;
     } else {
@@ -12,5 +12,6 @@
 
 int main() {
     char* heap_overflow = malloc(32 * 1024 * 1024);
+    heap_overflow[0]    = 1; /* malloc() returns NULL for 32MB. */
     return 0;
 }
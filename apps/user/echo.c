@@ -3,12 +3,36 @@
  * All rights reserved.
  *
  * Description: a simple echo
+ * With "> FILE" at the end, the words are written to an existing FILE
+ * instead of the terminal, and FILE is truncated to the one block holding
+ * them.
  */
 
 #include "app.h"
 
 int main(int argc, char** argv) {
-    for (uint i = 1; i < argc; i++) printf("%s ", argv[i]);
-    printf("\n\r");
-    return 0;
+    if (argc < 3 || strcmp(argv[argc - 2], ">") != 0) {
+        for (uint i = 1; i < argc; i++) printf("%s ", argv[i]);
+        printf("\n\r");
+        return 0;
+    }
+
+    int file_ino = file_lookup(workdir_ino, argv[argc - 1]);
+    if (file_ino < 0) {
+        INFO("echo: file %s not found", argv[argc - 1]);
+        INFO("usage: echo [WORDS] [> FILE], which overwrites an existing "
+             "FILE with one block");
+        return -1;
+    }
+
+    char buf[BLOCK_SIZE];
+    memset(buf, 0, BLOCK_SIZE);
+    for (uint i = 1; i < argc - 2; i++) {
+        if (strlen(buf) + strlen(argv[i]) + 2 >= BLOCK_SIZE) break;
+        strcat(buf, argv[i]);
+        strcat(buf, (i < argc - 3) ? " " : "\n");
+    }
+    if (file_write(file_ino, 0, buf) != 0 || file_setsize(file_ino, 1) != 0)
+        return -1;
+    return file_flush();
 }
@@ -0,0 +1,27 @@
+/*
+ * (C) 2026, Cornell University
+ * All rights reserved.
+ *
+ * Description: a demo of fork()
+ * The parent and the child share their pages until one of them writes.
+ */
+
+#include "app.h"
+
+int counter = 2000;
+
+int main() {
+    int pid = fork();
+    if (pid < 0) {
+        INFO("fork_demo: fork failed");
+        return -1;
+    }
+
+    /* The write below triggers a copy-on-write page fault. */
+    counter += (pid == 0) ? 1 : -1;
+    if (pid == 0)
+        printf("child: counter=%d\n\r", counter);
+    else
+        printf("parent of process %d: counter=%d\n\r", pid, counter);
+    return 0;
+}
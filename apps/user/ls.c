@@ -6,6 +6,7 @@
  */
 
 #include "app.h"
+#include "dir.h"
 
 int main(int argc, char** argv) {
     if (argc > 1) {
@@ -13,15 +14,21 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    /* Read the directory content. */
-    char buf[BLOCK_SIZE];
-    file_read(workdir_ino, 0, buf);
-
-    /* Remove the inode numbers from the string. */
-    for (uint i = 1; i < strlen(buf); i++)
-        if (buf[i - 1] == ' ' && buf[i] >= '0' && buf[i] <= '9') buf[i] = ' ';
+    /* Read the directory content block by block (see library/file/dir.h). */
+    struct dir_entry block[DIR_PER_BLOCK];
+    struct dir_header* header = (void*)block;
+    if (file_read(workdir_ino, 0, (void*)block) < 0 ||
+        header->magic != DIR_MAGIC) {
+        INFO("ls: the working directory is not a directory");
+        return -1;
+    }
 
-    /* Print out the directory content. */
-    printf("%s\n\r", buf);
+    /* Print out the names in the directory. */
+    for (uint b = 0, nblocks = header->nblocks; b < nblocks; b++) {
+        if (b) file_read(workdir_ino, b, (void*)block);
+        for (uint i = (b == 0); i < DIR_PER_BLOCK; i++)
+            if (block[i].name[0]) printf("%s ", block[i].name);
+    }
+    printf("\n\r");
     return 0;
 }
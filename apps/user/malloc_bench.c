@@ -0,0 +1,54 @@
+/*
+ * (C) 2026, Cornell University
+ * All rights reserved.
+ *
+ * Description: a benchmark of malloc() and free()
+ * Print the average time of a malloc() and free() pair for several object
+ * sizes, in ticks of the time CSR (10MHz on QEMU, see earth/cpu_intr.c).
+ */
+
+#include "app.h"
+#include <stdlib.h>
+
+#define NOBJS   64
+#define NROUNDS 50
+
+static ulonglong time_get() {
+    uint low, high, high2;
+    do {
+        asm volatile("rdtimeh %0" : "=r"(high));
+        asm volatile("rdtime %0" : "=r"(low));
+        asm volatile("rdtimeh %0" : "=r"(high2));
+    } while (high != high2);
+    return (((ulonglong)high) << 32) | low;
+}
+
+static char* objs[NOBJS];
+
+int main() {
+    uint sizes[] = {16, 100, 1000, 2048, 8192};
+
+    for (uint i = 0; i < sizeof(sizes) / sizeof(uint); i++) {
+        ulonglong start = time_get();
+        for (uint round = 0; round < NROUNDS; round++) {
+            for (uint j = 0; j < NOBJS; j++) {
+                if (!(objs[j] = malloc(sizes[i]))) {
+                    INFO("malloc_bench: out of memory");
+                    return -1;
+                }
+                objs[j][0] = 1; /* Touch the object. */
+            }
+            for (uint j = 0; j < NOBJS; j++) free(objs[j]);
+        }
+        uint ticks = time_get() - start;
+        printf("%d-byte objects: %d ticks per malloc/free pair\n\r", sizes[i],
+               ticks / (NROUNDS * NOBJS));
+    }
+
+    /* A short-lived app allocates and exits without calling free(). */
+    ulonglong start = time_get();
+    for (uint i = 0; i < NOBJS * NROUNDS; i++) malloc(16 + i % 200);
+    printf("mixed objects without free: %d ticks per malloc\n\r",
+           (uint)(time_get() - start) / (NOBJS * NROUNDS));
+    return 0;
+}
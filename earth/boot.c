@@ -10,7 +10,7 @@
 
 void tty_init();
 void disk_init();
-void mmu_init();
+void mmu_init(uint dtb);
 void intr_init(uint core_id);
 void grass_entry(uint core_id);
 
@@ -25,7 +25,8 @@ struct earth* earth = (void*)EARTH_STRUCT;
 
 /* Student's code ends here. */
 
-void boot() {
+void boot(uint hartid, uint dtb) {
+    /* QEMU passes the address of its device tree in register a1. */
     uint core_id, vendor_id;
     asm("csrr %0, mhartid" : "=r"(core_id));
     asm("csrr %0, mvendorid" : "=r"(vendor_id));
@@ -40,7 +41,7 @@ void boot() {
         disk_init();
         SUCCESS("Finished initializing the tty and disk devices");
 
-        mmu_init();
+        mmu_init(dtb);
         intr_init(core_id);
         SUCCESS("Finished initializing the MMU, timer and interrupts");
 
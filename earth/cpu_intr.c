@@ -47,6 +47,28 @@ void intr_init(uint core_id) {
     asm("csrs mie, %0" ::"r"(0x80));
     asm("csrs mstatus, %0" ::"r"(0x88));
 
+    /* Allow user mode to read the time CSR (e.g., apps/user/malloc_bench.c).
+     * On QEMU, time is backed by the CLINT mtime. */
+    if (earth->platform == QEMU) {
+        asm("csrs mcounteren, %0" ::"r"(0x2));
+        asm("csrs scounteren, %0" ::"r"(0x2));
+    }
+
+    /* Enable the external interrupt from the SD card in PLIC, which is raised
+     * upon the end of a disk request on QEMU (see earth/dev_disk.c). PLIC
+     * enables an IRQ for each core separately, and only the boot core, which
+     * calls intr_init() first, enables it, so only the boot core services
+     * disk interrupts. */
+    static uint disk_irq_enabled;
+    if (earth->platform == QEMU && !disk_irq_enabled++) {
+        REGW(PLIC_BASE, PLIC_PRIORITY(SDHCI_IRQ)) = 1;
+        REGW(PLIC_BASE, PLIC_THRESHOLD(core_id))  = 0;
+
+        uint enable = PLIC_ENABLE(core_id) + SDHCI_IRQ / 32 * 4;
+        REGW(PLIC_BASE, enable) |= 1 << (SDHCI_IRQ % 32);
+        asm("csrs mie, %0" ::"r"(0x800));
+    }
+
     /* Student's code goes here (Ethernet & TCP/IP). */
 
     /* Enable external interrupt. Find the IRQ number corresponding to the
@@ -4,38 +4,147 @@
  *
  * Description: wrapping the CPU interface for memory management unit (MMU)
  * This file contains functions for memory allocation/free, virtual memory
- * address translation (software TLB and page table), and cache flushing.
+ * address translation (software TLB and page table), the page cache shared
+ * by processes running the same executable, and cache flushing.
  */
 
 #include "egos.h"
+#include "servers.h"
 #include <string.h>
 
 #define PAGE_SIZE          4096
 #define PAGE_NO_TO_ADDR(x) (char*)(x * PAGE_SIZE)
 #define PAGE_ID_TO_ADDR(x) ((char*)APPS_PAGES_BASE + x * PAGE_SIZE)
 #define APPS_PAGES_CNT     (RAM_END - APPS_PAGES_BASE) / PAGE_SIZE
-
+#define RAM_END_DEFAULT    0x80600000UL /* 6MB memory starting at RAM_START */
+#define RAM_END_MAX        0xC0000000UL /* 1GB memory at most               */
+
+/* A page in use is either private to process pid, or shared by ref page
+ * table entries with pid == 0. A shared page may also be in the page cache,
+ * holding page vpage_no of the executable file cache_ino. A cached page stays
+ * in memory after its ref drops to 0, until mmu_alloc() reclaims it. The
+ * table takes the first pages at APPS_PAGES_BASE, sized by mmu_init(). */
 struct page_info {
     int use;
     int pid;
     uint vpage_no;
-} page_info_table[APPS_PAGES_CNT];
+    uint ref;
+    int cache_ino;
+} * page_info_table;
+static uint page_info_npages;
+
+/* A pool of zeroed pages for mmu_alloc_zeroed(), which is refilled by
+ * mmu_zero_refill() when there is no other work, such as when GPID_PROCESS
+ * waits for requests. The pages in the pool are owned by pid 0. */
+#define ZERO_POOL_SIZE 16
+static uint zero_pool[ZERO_POOL_SIZE], zero_pool_cnt;
+static uint zero_pool_hit, zero_pool_miss;
 
 uint mmu_alloc() {
     for (uint i = 0; i < APPS_PAGES_CNT; i++)
         if (!page_info_table[i].use) {
-            page_info_table[i].use = 1;
+            page_info_table[i].use       = 1;
+            page_info_table[i].cache_ino = -1;
             return i;
         }
+
+    /* Reclaim a cached page which is not mapped by any process. */
+    for (uint i = 0; i < APPS_PAGES_CNT; i++)
+        if (page_info_table[i].use && page_info_table[i].cache_ino >= 0 &&
+            page_info_table[i].ref == 0) {
+            page_info_table[i].cache_ino = -1;
+            page_info_table[i].vpage_no  = 0;
+            return i;
+        }
+
+    if (zero_pool_cnt) return zero_pool[--zero_pool_cnt];
     FATAL("mmu_alloc: no more free memory");
 }
 
+uint mmu_alloc_zeroed() {
+    if (zero_pool_cnt) {
+        zero_pool_hit++;
+        return zero_pool[--zero_pool_cnt];
+    }
+
+    zero_pool_miss++;
+    uint ppage_id = mmu_alloc();
+    memset(PAGE_ID_TO_ADDR(ppage_id), 0, PAGE_SIZE);
+    return ppage_id;
+}
+
+void mmu_zero_refill() {
+    /* Zero free pages ahead of time, without reclaiming cached pages. */
+    for (uint i = 0; i < APPS_PAGES_CNT; i++) {
+        if (zero_pool_cnt == ZERO_POOL_SIZE) return;
+        if (!page_info_table[i].use) {
+            page_info_table[i].use       = 1;
+            page_info_table[i].cache_ino = -1;
+            memset(PAGE_ID_TO_ADDR(i), 0, PAGE_SIZE);
+            zero_pool[zero_pool_cnt++] = i;
+        }
+    }
+}
+
+void mmu_info() {
+    uint nfree = 0, nprivate = 0, nshared = 0, ncached = 0;
+    for (uint i = 0; i < APPS_PAGES_CNT; i++) {
+        struct page_info* page = &page_info_table[i];
+        if (!page->use)
+            nfree++;
+        else if (page->cache_ino >= 0)
+            ncached++;
+        else if (page->ref)
+            nshared++;
+        else
+            nprivate++;
+    }
+    printf("pages: %d free, %d private, %d shared, %d cached, %d zeroed\n\r",
+           nfree, nprivate - zero_pool_cnt, nshared, ncached, zero_pool_cnt);
+    printf("zeroed page pool: %d hits, %d misses\n\r", zero_pool_hit,
+           zero_pool_miss);
+}
+
+static void mmu_unref(uint ppage_id) {
+    struct page_info* page = &page_info_table[ppage_id];
+    if (--page->ref == 0 && page->cache_ino < 0)
+        memset(page, 0, sizeof(struct page_info));
+}
+
+static void pagetable_free(int pid);
 void mmu_free(int pid) {
+    if (earth->translation == PAGE_TABLE) pagetable_free(pid);
+
     for (uint i = 0; i < APPS_PAGES_CNT; i++)
         if (page_info_table[i].use && page_info_table[i].pid == pid)
             memset(&page_info_table[i], 0, sizeof(struct page_info));
 }
 
+int mmu_cache_find(int ino, uint vpage_no) {
+    for (uint i = 0; i < APPS_PAGES_CNT; i++)
+        if (page_info_table[i].use && page_info_table[i].cache_ino == ino &&
+            page_info_table[i].vpage_no == vpage_no)
+            return i;
+    return -1;
+}
+
+void mmu_cache_add(int ino, uint vpage_no, uint ppage_id) {
+    page_info_table[ppage_id].pid       = 0;
+    page_info_table[ppage_id].vpage_no  = vpage_no;
+    page_info_table[ppage_id].cache_ino = ino;
+}
+
+void mmu_cache_drop(int ino) {
+    /* Take the pages of file ino out of the page cache after it is written.
+     * The processes mapping a page keep it until they free it. */
+    for (uint i = 0; i < APPS_PAGES_CNT; i++) {
+        struct page_info* page = &page_info_table[i];
+        if (!page->use || page->cache_ino != ino) continue;
+        if (page->ref == 0) memset(page, 0, sizeof(struct page_info));
+        else page->cache_ino = -1;
+    }
+}
+
 void soft_tlb_map(int pid, uint vpage_no, uint ppage_id) {
     page_info_table[ppage_id].pid      = pid;
     page_info_table[ppage_id].vpage_no = vpage_no;
@@ -65,28 +174,74 @@ uint soft_tlb_translate(int pid, uint vaddr) {
     return vaddr;
 }
 
+int soft_tlb_fault(int pid, uint vaddr) { return -1; }
+
+void soft_tlb_unmap(int pid, uint vpage_no) {
+    for (uint i = 0; i < APPS_PAGES_CNT; i++)
+        if (page_info_table[i].use && page_info_table[i].pid == pid &&
+            page_info_table[i].vpage_no == vpage_no)
+            memset(&page_info_table[i], 0, sizeof(struct page_info));
+}
+
+int soft_tlb_fork(int pid, int child) {
+    /* The pages of pid have been copied out by soft_tlb_switch() because
+     * the caller of fork is GPID_PROCESS, so simply copy every page. */
+    for (uint i = 0; i < APPS_PAGES_CNT; i++)
+        if (page_info_table[i].use && page_info_table[i].pid == pid) {
+            uint copy_id = mmu_alloc();
+            memcpy(PAGE_ID_TO_ADDR(copy_id), PAGE_ID_TO_ADDR(i), PAGE_SIZE);
+            soft_tlb_map(child, page_info_table[i].vpage_no, copy_id);
+        }
+    return 0;
+}
+
 /* The code below creates an identity map using page tables (RISC-V Sv32). */
 #define USER_RWX     (0xC0 | 0x1F)
+#define USER_RX      (0xC0 | 0x1B)
+#define USER_R       (0xC0 | 0x13)
+#define PTE_SHARED   0x100 /* RSW bit: the page is shared and ref-counted */
+#define PTE_COW      0x200 /* RSW bit: copy the page upon a write fault   */
 #define MAX_NPROCESS 256
 static uint* root;
 static uint* leaf;
 static uint* pid_to_pagetable_base[MAX_NPROCESS];
 /* Assume at most MAX_NPROCESS unique processes, just for simplicity. */
 
-void setup_identity_region(int pid, uint addr, uint npages, uint flag) {
-    uint vpn1 = addr >> 22;
+#define PTE_TO_PADDR(x)   (((x) << 2) & 0xFFFFF000)
+#define PTE_TO_PAGE_ID(x) (PTE_TO_PADDR(x) - APPS_PAGES_BASE) / PAGE_SIZE
+/* A page mapped from the flash ROM (see elf.c) is not in page_info_table. */
+#define PTE_IN_POOL(x)                                                         \
+    (PTE_TO_PADDR(x) >= APPS_PAGES_BASE && PTE_TO_PADDR(x) < RAM_END)
+
+/* The kernel translates SYSCALL_ARG upon every system call, so cache a few
+ * recent translations of each process in front of the page table walk. A
+ * cached translation is invalidated whenever its page table entry changes. */
+#define TCACHE_SIZE 4
+static struct tcache_entry {
+    uint vpage_no;
+    uint paddr; /* 0 means invalid */
+} tcache[MAX_NPROCESS][TCACHE_SIZE];
 
+static void tcache_invalidate(int pid, uint vpage_no) {
+    struct tcache_entry* entry = &tcache[pid][vpage_no % TCACHE_SIZE];
+    if (entry->vpage_no == vpage_no) entry->paddr = 0;
+}
+
+static void setup_leaf(int pid, uint vpn1) {
     if (root[vpn1] & 0x1) {
         /* Leaf has been allocated. */
-        leaf = (void*)((root[vpn1] << 2) & 0xFFFFF000);
+        leaf = (void*)PTE_TO_PADDR(root[vpn1]);
     } else {
         /* Allocate the leaf page table. */
-        uint ppage_id                 = earth->mmu_alloc();
+        uint ppage_id                 = mmu_alloc_zeroed();
         leaf                          = (void*)PAGE_ID_TO_ADDR(ppage_id);
         page_info_table[ppage_id].pid = pid;
-        memset(leaf, 0, PAGE_SIZE);
-        root[vpn1] = ((uint)leaf >> 2) | 0x1;
+        root[vpn1]                    = ((uint)leaf >> 2) | 0x1;
     }
+}
+
+void setup_identity_region(int pid, uint addr, uint npages, uint flag) {
+    setup_leaf(pid, addr >> 22);
 
     /* Set up the entries in the leaf page table. */
     uint vpn0 = (addr >> 12) & 0x3FF;
@@ -94,17 +249,27 @@ void setup_identity_region(int pid, uint addr, uint npages, uint flag) {
         leaf[vpn0 + i] = ((addr + i * PAGE_SIZE) >> 2) | flag;
 }
 
-void pagetable_identity_map(int pid) {
+static void setup_root(int pid) {
     /* Allocate the root page table. */
-    uint ppage_id                 = earth->mmu_alloc();
+    uint ppage_id                 = mmu_alloc_zeroed();
     root                          = (void*)PAGE_ID_TO_ADDR(ppage_id);
     page_info_table[ppage_id].pid = pid;
     pid_to_pagetable_base[pid]    = root;
-    memset(root, 0, PAGE_SIZE);
+}
 
-    /* Set up the identity map for various memory regions. */
-    for (uint i = RAM_START; i < RAM_END; i += PAGE_SIZE * 1024)
-        setup_identity_region(pid, i, 1024, USER_RWX);
+void pagetable_identity_map(int pid) {
+    setup_root(pid);
+
+    /* Set up the identity map for various memory regions. Only the kernel
+     * and GPID_PROCESS, which loads and maps pages for other processes, map
+     * the pages for mmu_alloc; the other system processes only map the RAM
+     * below them and page_info_table (e.g., for mmu_info). */
+    uint ram_end = APPS_PAGES_BASE + page_info_npages * PAGE_SIZE;
+    if (pid == 0 || pid == GPID_PROCESS) ram_end = RAM_END;
+    for (uint i = RAM_START; i < ram_end; i += PAGE_SIZE * 1024) {
+        uint npages = (ram_end - i) / PAGE_SIZE;
+        setup_identity_region(pid, i, npages < 1024 ? npages : 1024, USER_RWX);
+    }
 
     setup_identity_region(pid, ETH_CTL_BASE, 4, USER_RWX);
     setup_identity_region(pid, UART_BASE, 1, USER_RWX);
@@ -115,6 +280,7 @@ void pagetable_identity_map(int pid) {
     if (earth->platform == QEMU) {
         setup_identity_region(pid, ETH_PCI_ECAM, 1, USER_RWX);
         setup_identity_region(pid, SDHCI_BASE, 1, USER_RWX);
+        setup_identity_region(pid, QEMU_TEST_BASE, 1, USER_RWX);
     } else {
         setup_identity_region(pid, SDSPI_BASE, 1, USER_RWX);
         setup_identity_region(pid, WIFI_BASE, 1, USER_RWX);
@@ -122,43 +288,129 @@ void pagetable_identity_map(int pid) {
     }
 }
 
-void page_table_map(int pid, uint vpage_no, uint ppage_id) {
+static uint* pagetable_pte(int pid, uint vpage_no) {
+    uint* base = pid_to_pagetable_base[pid];
+    if (!base || !(base[vpage_no >> 10] & 0x1)) return NULL;
+
+    uint* table = (void*)PTE_TO_PADDR(base[vpage_no >> 10]);
+    return &table[vpage_no & 0x3FF];
+}
+
+static void pagetable_init(int pid) {
+    /* System processes get the identity map from pagetable_identity_map();
+     * user processes only get SHELL_WORK_DIR (see apps/app.h). */
+    if (pid < GPID_USER_START) {
+        /* The application region is private, not the identity map. */
+        pagetable_identity_map(pid);
+        setup_leaf(pid, APPS_ENTRY >> 22);
+        memset(&leaf[(APPS_ENTRY >> 12) & 0x3FF], 0,
+               (APPS_STACK_TOP - APPS_ENTRY) / PAGE_SIZE * sizeof(uint));
+    } else {
+        setup_root(pid);
+        setup_identity_region(pid, SHELL_WORK_DIR, 1, USER_RWX);
+    }
+}
+
+static void pagetable_set(int pid, uint vpage_no, uint paddr, uint flag) {
     if (pid >= MAX_NPROCESS) FATAL("page_table_map: pid too large");
 
     /* Student's code goes here (Virtual Memory). */
 
-    /* Remove the soft_tlb_map below and do the following.
-     * (1) If page tables for process pid do not exist, initialize page tables.
-     *   * Initialization Case#1: pid < GPID_USER_START
-     * | Start Address   | # Pages | Size  | Explanation                       |
-     * +-----------------+---------+-------+-----------------------------------+
-     * | RAM_START       | 512     | 2 MB  | EGOS code, data, heap, stack      |
-     * | APPS_ENTRY      | 512     | 2 MB  | Apps code, data, heap, stack      |
-     * | APPS_PAGES_BASE | 512     | 2 MB  | Memory pages for page_alloc()     |
-     * | UART_BASE       | 1       | 4 KB  | Memory-mapped registers for TTY   |
-     * | SDHCI_BASE      | 1       | 4 KB  | Memory-mapped registers for SD    |
-     * | CLINT_BASE      | 16      | 64 KB | Memory-mapped registers for timer |
-     *
-     *   * Initialization Case#2: pid >= GPID_USER_START
-     * | Start Address   | # Pages | Size  | Explanation                       |
-     * +-----------------+---------+-------+-----------------------------------+
-     * | SHELL_WORK_DIR  | 1       | 4 KB  | Work dir (see apps/app.h)         |
-     * In later projects, you can add mappings for Ethernet, Wi-Fi, or VGA/HDMI.
-     *
-     * (2) After page tables for process pid have been initialized, update the
-     *     page tables and map *vpage_no* to *ppage_id* according to Sv32. */
-    soft_tlb_map(pid, vpage_no, ppage_id);
+    /* Initialize the page tables when process pid maps its first page. */
+    if (!pid_to_pagetable_base[pid]) pagetable_init(pid);
+
+    /* Map vpage_no to ppage_id according to Sv32. */
+    root = pid_to_pagetable_base[pid];
+    setup_leaf(pid, vpage_no >> 10);
+    leaf[vpage_no & 0x3FF] = (paddr >> 2) | flag;
+    tcache_invalidate(pid, vpage_no);
 
     /* Student's code ends here. */
 }
 
+void page_table_map(int pid, uint vpage_no, uint ppage_id) {
+    pagetable_set(pid, vpage_no, (uint)PAGE_ID_TO_ADDR(ppage_id), USER_RWX);
+    soft_tlb_map(pid, vpage_no, ppage_id);
+}
+
+void page_table_map_shared(int pid, uint vpage_no, uint ppage_id, uint cow) {
+    /* A copy-on-write page is read-only until process pid writes to it. */
+    page_info_table[ppage_id].ref++;
+    pagetable_set(pid, vpage_no, (uint)PAGE_ID_TO_ADDR(ppage_id),
+                  PTE_SHARED | (cow ? (USER_R | PTE_COW) : USER_RX));
+}
+
+void page_table_map_rom(int pid, uint vpage_no, uint paddr) {
+    /* Execute a read-only page in place from the memory-mapped flash ROM. */
+    pagetable_set(pid, vpage_no, paddr, USER_RX);
+}
+
+void page_table_unmap(int pid, uint vpage_no) {
+    uint* pte = pagetable_pte(pid, vpage_no);
+    if (!pte || !(*pte & 0x1)) return;
+
+    /* The TLB is flushed when the kernel switches back to process pid. */
+    uint ppage_id = PTE_TO_PAGE_ID(*pte);
+    if (*pte & PTE_SHARED)
+        mmu_unref(ppage_id);
+    else if (PTE_IN_POOL(*pte))
+        memset(&page_info_table[ppage_id], 0, sizeof(struct page_info));
+    *pte = 0;
+    tcache_invalidate(pid, vpage_no);
+}
+
+int page_table_fork(int pid, int child) {
+    if (child >= MAX_NPROCESS) FATAL("page_table_fork: pid too large");
+    pagetable_init(child);
+
+    for (uint i = APPS_ENTRY / PAGE_SIZE; i < APPS_STACK_TOP / PAGE_SIZE; i++) {
+        uint* pte = pagetable_pte(pid, i);
+        if (!pte || !(*pte & 0x1)) continue;
+
+        uint ppage_id = PTE_TO_PAGE_ID(*pte);
+        if (!PTE_IN_POOL(*pte)) {
+            pagetable_set(child, i, PTE_TO_PADDR(*pte), *pte & 0x3FF);
+        } else if (i == SYSCALL_ARG / PAGE_SIZE) {
+            /* The kernel writes this page directly, so never share it. */
+            uint copy_id = mmu_alloc();
+            memcpy(PAGE_ID_TO_ADDR(copy_id), PAGE_ID_TO_ADDR(ppage_id),
+                   PAGE_SIZE);
+            page_table_map(child, i, copy_id);
+        } else if (*pte & PTE_SHARED) {
+            page_table_map_shared(child, i, ppage_id, *pte & PTE_COW);
+        } else {
+            /* Turn a private page into a copy-on-write page. The TLB is
+             * flushed when the kernel switches back to process pid. */
+            page_info_table[ppage_id].pid = 0;
+            page_info_table[ppage_id].ref = 1;
+            *pte = PTE_SHARED | PTE_COW | USER_R |
+                   ((uint)PAGE_ID_TO_ADDR(ppage_id) >> 2);
+            tcache_invalidate(pid, i);
+            page_table_map_shared(child, i, ppage_id, 1);
+        }
+    }
+    return 0;
+}
+
+static void pagetable_free(int pid) {
+    if (pid >= MAX_NPROCESS || !pid_to_pagetable_base[pid]) return;
+
+    /* Release the shared pages mapped in the application memory region. The
+     * page tables themselves are private pages and freed by mmu_free(). */
+    for (uint i = APPS_ENTRY / PAGE_SIZE; i < APPS_STACK_TOP / PAGE_SIZE; i++) {
+        uint* pte = pagetable_pte(pid, i);
+        if (pte && (*pte & PTE_SHARED)) mmu_unref(PTE_TO_PAGE_ID(*pte));
+    }
+    pid_to_pagetable_base[pid] = NULL;
+    memset(tcache[pid], 0, sizeof(tcache[pid]));
+}
+
 void page_table_switch(int pid) {
     /* Student's code goes here (Virtual Memory). */
 
-    /* Remove the soft_tlb_switch below and, instead, update the page table
-     * base register (satp) using the value of pid_to_pagetable_base[pid].
-     * An example of updating the satp CSR is given in mmu_init(). */
-    soft_tlb_switch(pid);
+    /* Update the page table base register (satp) with the root of pid. */
+    asm("csrw satp, %0" ::"r"(((uint)pid_to_pagetable_base[pid] >> 12) |
+                               (1 << 31)));
 
     /* Student's code ends here. */
 }
@@ -166,13 +418,42 @@ void page_table_switch(int pid) {
 uint page_table_translate(int pid, uint vaddr) {
     /* Student's code goes here (Virtual Memory). */
 
-    /* Remove the following line of code. Walk through the page tables
-     * for process pid and return the physical address mapped from vaddr. */
-    return soft_tlb_translate(pid, vaddr);
+    /* Walk through the page tables for process pid upon a cache miss. */
+    uint vpage_no              = vaddr / PAGE_SIZE;
+    struct tcache_entry* entry = &tcache[pid][vpage_no % TCACHE_SIZE];
+    if (entry->paddr == 0 || entry->vpage_no != vpage_no) {
+        uint* pte = pagetable_pte(pid, vpage_no);
+        if (!pte || !(*pte & 0x1))
+            FATAL("page_table_translate: pid=%d vaddr=0x%x unmapped", pid,
+                  vaddr);
+        entry->vpage_no = vpage_no;
+        entry->paddr    = PTE_TO_PADDR(*pte);
+    }
+    return entry->paddr | (vaddr & 0xFFF);
 
     /* Student's code ends here. */
 }
 
+int page_table_fault(int pid, uint vaddr);
+uint mmu_dma_translate(int pid, uint vaddr, uint device_write) {
+    /* Translate vaddr of process pid, or of the kernel if pid is 0, for a
+     * device doing DMA, or return 0 if the page is unmapped or read-only.
+     * With the software TLB, the pages of another process can be copied into
+     * the app region while the device is busy, so return 0 for that region. */
+    if (pid == 0) return vaddr;
+    if (earth->translation == SOFT_TLB)
+        return (vaddr >= APPS_ENTRY && vaddr < APPS_STACK_TOP) ? 0 : vaddr;
+
+    /* Before the device writes to a page, handle it like a write fault of
+     * process pid, which maps a zeroed page or copies a copy-on-write page. */
+    uint* pte = pagetable_pte(pid, vaddr / PAGE_SIZE);
+    if (device_write && (!pte || !(*pte & 0x4)) &&
+        page_table_fault(pid, vaddr) == 0)
+        pte = pagetable_pte(pid, vaddr / PAGE_SIZE);
+    if (!pte || !(*pte & 0x1) || (device_write && !(*pte & 0x4))) return 0;
+    return PTE_TO_PADDR(*pte) | (vaddr & 0xFFF);
+}
+
 void flush_cache() {
     if (earth->platform == HARDWARE) {
         /* Flush the L1 instruction cache. */
@@ -190,10 +471,120 @@ void flush_cache() {
     }
 }
 
-void mmu_init() {
-    earth->mmu_free        = mmu_free;
-    earth->mmu_alloc       = mmu_alloc;
-    earth->mmu_flush_cache = flush_cache;
+int page_table_fault(int pid, uint vaddr) {
+    /* Map a zeroed page upon the first access to an unmapped page in the
+     * application region, i.e., the heap (see library/libc/malloc.c) or the
+     * stack growing beyond the pages set up by elf_load(). */
+    uint* pte = pagetable_pte(pid, vaddr / PAGE_SIZE);
+    if ((!pte || !(*pte & 0x1)) && vaddr >= APPS_ENTRY &&
+        vaddr < APPS_STACK_TOP) {
+        page_table_map(pid, vaddr / PAGE_SIZE, mmu_alloc_zeroed());
+        flush_cache();
+        return 0;
+    }
+
+    /* Handle a write to a copy-on-write page of process pid. */
+    if (!pte || !(*pte & PTE_COW)) return -1;
+
+    uint ppage_id = PTE_TO_PAGE_ID(*pte);
+    struct page_info* page = &page_info_table[ppage_id];
+    if (page->ref == 1 && page->cache_ino < 0) {
+        /* Process pid holds the last reference, so take over the page. */
+        page->ref = 0;
+    } else {
+        uint copy_id = mmu_alloc();
+        memcpy(PAGE_ID_TO_ADDR(copy_id), PAGE_ID_TO_ADDR(ppage_id), PAGE_SIZE);
+        mmu_unref(ppage_id);
+        ppage_id = copy_id;
+    }
+
+    page_info_table[ppage_id].pid      = pid;
+    page_info_table[ppage_id].vpage_no = vaddr / PAGE_SIZE;
+    *pte = ((uint)PAGE_ID_TO_ADDR(ppage_id) >> 2) | USER_RWX;
+    tcache_invalidate(pid, vaddr / PAGE_SIZE);
+    flush_cache();
+    return 0;
+}
+
+/* QEMU passes a device tree (https://devicetree-specification.readthedocs.io)
+ * to the boot loader, and its /memory node holds the base and size of RAM. */
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT32(x)       __builtin_bswap32(*(uint*)(x))
+
+static uint fdt_ram_end(uint dtb) {
+    if (FDT32(dtb) != 0xD00DFEED) return 0;
+    uint* token   = (void*)(dtb + FDT32(dtb + 8));
+    char* strings = (char*)dtb + FDT32(dtb + 12);
+
+    for (uint depth = 0, memory = 0, naddr = 2, nsize = 1;;) {
+        switch (FDT32(token++)) {
+        case FDT_BEGIN_NODE:
+            memory = (++depth == 2 && !strncmp((char*)token, "memory", 6));
+            token += (strlen((char*)token) + 4) / 4;
+            break;
+        case FDT_END_NODE:
+            depth--;
+            break;
+        case FDT_PROP: {
+            uint *val = token + 2, len = FDT32(token);
+            char* name = strings + FDT32(token + 1);
+            if (depth == 1 && !strcmp(name, "#address-cells"))
+                naddr = FDT32(val);
+            if (depth == 1 && !strcmp(name, "#size-cells")) nsize = FDT32(val);
+            /* Only use the lower 32 bits of the base and size, and return
+             * the last page if the end is beyond the 32-bit address space. */
+            if (memory && !strcmp(name, "reg")) {
+                uint base = FDT32(val + naddr - 1);
+                uint size = FDT32(val + naddr + nsize - 1);
+                return (size < -base) ? base + size : -PAGE_SIZE;
+            }
+            token += 2 + (len + 3) / 4;
+            break;
+        }
+        case FDT_NOP:
+            break;
+        default:
+            return 0;
+        }
+    }
+}
+
+void mmu_init(uint dtb) {
+    /* The device tree is at the end of RAM, so RAM_END stops before it.
+     * RAM_END_MAX bounds the identity map of the kernel and GPID_PROCESS
+     * (one leaf page table for every 4MB) and page_info_table. */
+    uint ram_end   = (earth->platform == QEMU) ? fdt_ram_end(dtb) : 0;
+    earth->ram_end = RAM_END_DEFAULT;
+    if (ram_end > RAM_END_DEFAULT) {
+        ram_end        = (ram_end < dtb) ? ram_end : dtb;
+        ram_end        = (ram_end < RAM_END_MAX) ? ram_end : RAM_END_MAX;
+        earth->ram_end = ram_end & ~(PAGE_SIZE - 1);
+    }
+
+    /* Take the first pages for mmu_alloc for page_info_table. */
+    uint nbytes      = APPS_PAGES_CNT * sizeof(struct page_info);
+    page_info_table  = (void*)APPS_PAGES_BASE;
+    page_info_npages = (nbytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    memset(page_info_table, 0, nbytes);
+    for (uint i = 0; i < page_info_npages; i++) {
+        page_info_table[i].use       = 1;
+        page_info_table[i].cache_ino = -1;
+    }
+    INFO("Use %d KB of memory for mmu_alloc, [0x%x, 0x%x)",
+         (RAM_END - APPS_PAGES_BASE) / 1024, APPS_PAGES_BASE, RAM_END);
+
+    earth->mmu_free         = mmu_free;
+    earth->mmu_alloc        = mmu_alloc;
+    earth->mmu_alloc_zeroed = mmu_alloc_zeroed;
+    earth->mmu_zero_refill  = mmu_zero_refill;
+    earth->mmu_flush_cache  = flush_cache;
+    earth->mmu_info         = mmu_info;
+    earth->mmu_cache_find   = mmu_cache_find;
+    earth->mmu_cache_add    = mmu_cache_add;
+    earth->mmu_cache_drop   = mmu_cache_drop;
 
     /* Set up a PMP region for the whole 4GB address space. */
     asm("csrw pmpaddr0, %0" : : "r"(0x40000000));
@@ -221,12 +612,23 @@ void mmu_init() {
         pagetable_identity_map(0);
         asm("csrw satp, %0" ::"r"(((uint)root >> 12) | (1 << 31)));
 
-        earth->mmu_map       = page_table_map;
-        earth->mmu_switch    = page_table_switch;
-        earth->mmu_translate = page_table_translate;
+        earth->mmu_map        = page_table_map;
+        earth->mmu_map_shared = page_table_map_shared;
+        earth->mmu_map_rom    = page_table_map_rom;
+        earth->mmu_unmap      = page_table_unmap;
+        earth->mmu_switch     = page_table_switch;
+        earth->mmu_translate  = page_table_translate;
+        earth->mmu_fault      = page_table_fault;
+        earth->mmu_fork       = page_table_fork;
     } else {
+        /* Pages cannot be shared when every process is copied in and out
+         * of the same physical memory, so mmu_map_shared and mmu_map_rom
+         * remain NULL. */
         earth->mmu_map       = soft_tlb_map;
+        earth->mmu_unmap     = soft_tlb_unmap;
         earth->mmu_switch    = soft_tlb_switch;
         earth->mmu_translate = soft_tlb_translate;
+        earth->mmu_fault     = soft_tlb_fault;
+        earth->mmu_fork      = soft_tlb_fork;
     }
 }
@@ -9,19 +9,26 @@
 #include "process.h"
 #include "elf.h"
 
-static void sys_proc_read(uint block_no, char* dst) {
-    earth->disk_read(SYS_PROC_EXEC_START + block_no, 1, dst);
+static void sys_proc_read(uint block_no, uint nblocks, char* dst) {
+    earth->disk_read(SYS_PROC_EXEC_START + block_no, nblocks, dst);
+}
+
+static char* sys_proc_map(uint block_no) {
+    return earth->disk_map(SYS_PROC_EXEC_START + block_no);
 }
 
 void grass_entry(uint core_id) {
     SUCCESS("Enter the grass layer");
 
     /* Initialize the grass interface. */
-    grass->proc_free      = proc_free;
-    grass->proc_alloc     = proc_alloc;
-    grass->proc_set_ready = proc_set_ready;
-    grass->sys_send       = sys_send;
-    grass->sys_recv       = sys_recv;
+    grass->proc_free       = proc_free;
+    grass->proc_alloc      = proc_alloc;
+    grass->proc_set_ready  = proc_set_ready;
+    grass->proc_fork       = proc_fork;
+    grass->sys_send        = sys_send;
+    grass->sys_recv        = sys_recv;
+    grass->sys_disk_submit = sys_disk_submit;
+    grass->sys_disk_wait   = sys_disk_wait;
     /* Student's code goes here (System Call | Multicore & Locks). */
 
     /* Initialize the grass interface for proc_sleep() or proc_coresinfo(). */
@@ -30,7 +37,7 @@ void grass_entry(uint core_id) {
 
     /* Load GPID_PROCESS. */
     INFO("Load kernel process #%d: sys_process", GPID_PROCESS);
-    elf_load(GPID_PROCESS, sys_proc_read, 0, 0);
+    elf_load(GPID_PROCESS, sys_proc_read, sys_proc_map, -1, 0, 0);
     proc_set_running(proc_alloc());
     earth->mmu_switch(GPID_PROCESS);
     earth->mmu_flush_cache();
@@ -40,10 +40,14 @@ void kernel_entry() {
     memcpy((void*)(EGOS_STACK_TOP - 32 * 4), curr_saved, 32 * 4);
 }
 
-#define INTR_ID_TIMER   7
-#define EXCP_ID_ECALL_U 8
-#define EXCP_ID_ECALL_M 11
+#define INTR_ID_TIMER        7
+#define INTR_ID_EXTERNAL     11
+#define EXCP_ID_ECALL_U      8
+#define EXCP_ID_ECALL_M      11
+#define EXCP_ID_LOAD_PG_FLT  13
+#define EXCP_ID_STORE_PG_FLT 15
 static void proc_yield();
+static void proc_wait_disk();
 static void proc_try_syscall(struct process* proc);
 
 static void excp_entry(uint id) {
@@ -60,6 +64,14 @@ static void excp_entry(uint id) {
         proc_yield();
         return;
     }
+
+    if (id == EXCP_ID_LOAD_PG_FLT || id == EXCP_ID_STORE_PG_FLT) {
+        /* Map a zeroed page upon the first access to the heap or stack, or
+         * copy a shared page upon the first write (i.e., copy-on-write). */
+        uint mtval;
+        asm("csrr %0, mtval" : "=r"(mtval));
+        if (earth->mmu_fault(curr_pid, mtval) == 0) return;
+    }
     /* Student's code goes here (System Call & Protection | Virtual Memory). */
 
     /* Kill the current process if curr_pid is a user application. */
@@ -77,15 +89,36 @@ static void intr_entry(uint id) {
 
     if (id == INTR_ID_TIMER) return proc_yield();
 
+    /* Claim the external interrupt, where irq 0 means that there is none,
+     * e.g., because another core has claimed it. */
+    uint irq = 0;
+    if (id == INTR_ID_EXTERNAL) {
+        irq = REGW(PLIC_BASE, PLIC_CLAIM(core_in_kernel));
+        if (irq == SDHCI_IRQ) {
+            /* A disk request ends, so a process waiting for it can run. */
+            earth->disk_intr();
+            REGW(PLIC_BASE, PLIC_CLAIM(core_in_kernel)) = irq;
+            return proc_yield();
+        }
+    }
+
     /* Student's code goes here (Ethernet & TCP/IP). */
 
     /* Handle an external interrupt from the Intel Gigabit Ethernet Controller.
-     * Specifically, you need to (1) Claim the PLIC interrupt; (2) Check if the
-     * interrupt is for receiving an Ethernet frame; (3) Read the received frame
-     * from an RX buffer and print the content; (4) Complete the PLIC interrupt,
-     * so PLIC can fire the next interrupt; (5) Call proc_yield() and return. */
+     * Specifically, you need to (1) Take the PLIC interrupt claimed above as
+     * irq; (2) Check if the interrupt is for receiving an Ethernet frame; (3)
+     * Read the received frame from an RX buffer and print the content; (4)
+     * Complete the PLIC interrupt, so PLIC can fire the next interrupt; (5)
+     * Call proc_yield() and return. */
 
     /* Student's code ends here. */
+
+    /* Complete and ignore an interrupt from any other source, so that PLIC
+     * does not keep it claimed. */
+    if (irq) {
+        REGW(PLIC_BASE, PLIC_CLAIM(core_in_kernel)) = irq;
+        INFO("intr_entry: ignore external interrupt %d", irq);
+    }
 }
 
 static void proc_yield() {
@@ -99,15 +132,22 @@ static void proc_yield() {
      * [System Call & Protection]
      * Do not schedule a process that should still be sleeping at this time. */
 
-    int next_idx = MAX_NPROCESS;
-    for (uint i = 1; i <= MAX_NPROCESS; i++) {
-        struct process* p = &proc_set[(curr_proc_idx + i) % MAX_NPROCESS];
-        if (p->status == PROC_PENDING_SYSCALL) proc_try_syscall(p);
-
-        if (p->status == PROC_READY || p->status == PROC_RUNNABLE) {
-            next_idx = (curr_proc_idx + i) % MAX_NPROCESS;
-            break;
+    /* Wait for the disk interrupt and look again if no process can run
+     * while some process waits for an ongoing disk request. */
+    int next_idx;
+    while (1) {
+        next_idx = MAX_NPROCESS;
+        for (uint i = 1; i <= MAX_NPROCESS; i++) {
+            struct process* p = &proc_set[(curr_proc_idx + i) % MAX_NPROCESS];
+            if (p->status == PROC_PENDING_SYSCALL) proc_try_syscall(p);
+
+            if (p->status == PROC_READY || p->status == PROC_RUNNABLE) {
+                next_idx = (curr_proc_idx + i) % MAX_NPROCESS;
+                break;
+            }
         }
+        if (next_idx < MAX_NPROCESS || !earth->disk_busy()) break;
+        proc_wait_disk();
     }
 
     if (next_idx < MAX_NPROCESS) {
@@ -142,6 +182,61 @@ static void proc_yield() {
     earth->timer_reset(core_in_kernel);
 }
 
+static void proc_wait_disk() {
+    /* The kernel runs with interrupts disabled, but wfi still returns upon
+     * a pending interrupt. Reset the timer first, so that the core sleeps
+     * until the disk interrupt or the end of a time slice. Only the boot
+     * core takes the disk interrupt (see earth/cpu_intr.c), and any other
+     * core checks the disk after waking up. */
+    earth->timer_reset(core_in_kernel);
+    asm("wfi");
+
+    uint irq = REGW(PLIC_BASE, PLIC_CLAIM(core_in_kernel));
+    earth->disk_intr();
+    if (irq) REGW(PLIC_BASE, PLIC_CLAIM(core_in_kernel)) = irq;
+}
+
+/* The disk requests of processes are copied into the kernel, so that the
+ * disk queues are only changed by the kernel (see earth/dev_disk.c). Each
+ * copy keeps the address of the request in the memory of its owner, which
+ * is handed back by SYS_DISK_WAIT after the device has served it. */
+#define DISK_NREQUEST 64
+static struct disk_slot {
+    struct disk_request req;   /* must be the first field */
+    struct disk_request* user; /* NULL if the slot is free */
+} disk_slot[DISK_NREQUEST];
+
+static void proc_disk_submit(struct process* proc) {
+    struct disk_slot* slot = disk_slot;
+    while (slot < disk_slot + DISK_NREQUEST && slot->user) slot++;
+    if (slot == disk_slot + DISK_NREQUEST)
+        FATAL("proc_disk_submit: too many disk requests");
+
+    memcpy(&slot->user, proc->syscall.content, sizeof(slot->user));
+    memcpy(&slot->req, proc->syscall.content + sizeof(slot->user),
+           sizeof(slot->req));
+    slot->req.owner = proc->pid;
+    earth->disk_submit(&slot->req);
+
+    proc->syscall.status = DONE;
+    proc_set_runnable(proc->pid);
+}
+
+static void proc_disk_wait(struct process* proc) {
+    /* Only a request of this process makes it runnable again. */
+    struct disk_slot* slot = (void*)earth->disk_complete(proc->pid);
+    if (!slot) return;
+
+    memcpy(proc->syscall.content, &slot->user, sizeof(slot->user));
+    slot->user           = NULL;
+    proc->syscall.status = DONE;
+
+    /* Copy the system call struct from the kernel back to user space. */
+    uint syscall_paddr = earth->mmu_translate(proc->pid, SYSCALL_ARG);
+    memcpy((void*)syscall_paddr, &proc->syscall, sizeof(struct syscall));
+    proc_set_runnable(proc->pid);
+}
+
 static void proc_try_send(struct process* sender) {
     for (uint i = 0; i < MAX_NPROCESS; i++) {
         struct process* dst = &proc_set[i];
@@ -187,6 +282,12 @@ static void proc_try_syscall(struct process* proc) {
     case SYS_SEND:
         proc_try_send(proc);
         break;
+    case SYS_DISK_SUBMIT:
+        proc_disk_submit(proc);
+        break;
+    case SYS_DISK_WAIT:
+        proc_disk_wait(proc);
+        break;
     default:
         FATAL("proc_try_syscall: unknown syscall type=%d", proc->syscall.type);
     }
@@ -6,6 +6,7 @@
  */
 
 #include "process.h"
+#include <string.h>
 
 #define MLFQ_NLEVELS          5
 #define MLFQ_RESET_PERIOD     100000000         /* 10 seconds */
@@ -42,6 +43,34 @@ int proc_alloc() {
     FATAL("proc_alloc: reach the limit of %d processes", MAX_NPROCESS);
 }
 
+int proc_fork(int pid) {
+    struct process* parent = NULL;
+    for (uint i = 0; i < MAX_NPROCESS; i++)
+        if (proc_set[i].pid == pid && proc_set[i].status != PROC_UNUSED)
+            parent = &proc_set[i];
+    if (parent == NULL) return -1;
+
+    /* The parent has sent PROC_FORK to GPID_PROCESS, and it is either about
+     * to receive or already waiting for the reply. The child is a copy of
+     * the parent, so it will receive its own reply from GPID_PROCESS. */
+    int child_pid = proc_alloc();
+    for (uint i = 0; i < MAX_NPROCESS; i++)
+        if (proc_set[i].pid == child_pid) {
+            memcpy(&proc_set[i].syscall, &parent->syscall,
+                   sizeof(struct syscall));
+            memcpy(proc_set[i].saved_registers, parent->saved_registers,
+                   sizeof(parent->saved_registers));
+            proc_set[i].mepc = parent->mepc;
+        }
+
+    if (earth->mmu_fork(pid, child_pid) < 0) {
+        proc_free(child_pid);
+        return -1;
+    }
+    proc_set_status(child_pid, parent->status);
+    return child_pid;
+}
+
 void proc_free(int pid) {
     /* Student's code goes here (Preemptive Scheduling). */
 
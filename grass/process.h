@@ -28,6 +28,7 @@ struct process {
 ulonglong mtime_get();
 
 int proc_alloc();
+int proc_fork(int);
 void proc_free(int);
 void proc_set_ready(int);
 void proc_set_running(int);
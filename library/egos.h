@@ -5,33 +5,56 @@ typedef unsigned short ushort;
 typedef unsigned int uint;
 typedef unsigned long long ulonglong;
 
+struct disk_request; /* See library/file/disk.h */
 struct earth {
     uint (*mmu_alloc)();
+    uint (*mmu_alloc_zeroed)();
     void (*mmu_free)(int pid);
+    void (*mmu_zero_refill)();
     void (*mmu_flush_cache)();
+    void (*mmu_info)();
     void (*timer_reset)(uint core_id);
 
     void (*mmu_map)(int pid, uint vpage_no, uint ppage_id);
+    void (*mmu_map_shared)(int pid, uint vpage_no, uint ppage_id, uint cow);
+    void (*mmu_map_rom)(int pid, uint vpage_no, uint paddr);
+    void (*mmu_unmap)(int pid, uint vpage_no);
     uint (*mmu_translate)(int pid, uint vaddr);
     void (*mmu_switch)(int pid);
+    int (*mmu_fault)(int pid, uint vaddr);
+    int (*mmu_fork)(int pid, int child);
+
+    int (*mmu_cache_find)(int ino, uint vpage_no);
+    void (*mmu_cache_add)(int ino, uint vpage_no, uint ppage_id);
+    void (*mmu_cache_drop)(int ino);
 
     void (*tty_read)(char* c);
     void (*tty_write)(char c);
     uint (*tty_input_empty)();
     void (*disk_read)(uint block_no, uint nblocks, char* dst);
     void (*disk_write)(uint block_no, uint nblocks, char* src);
+    void (*disk_submit)(struct disk_request* req);
+    struct disk_request* (*disk_complete)(int owner);
+    int (*disk_busy)();
+    void (*disk_intr)();
+    void (*disk_info)();
+    char* (*disk_map)(uint block_no);
 
     enum { HARDWARE, QEMU } platform;
     enum { PAGE_TABLE, SOFT_TLB } translation;
+    uint ram_end;
 };
 
 struct grass {
     int (*proc_alloc)();
     void (*proc_free)(int pid);
     void (*proc_set_ready)(int pid);
+    int (*proc_fork)(int pid);
 
     void (*sys_send)(int receiver, char* msg, uint size);
     void (*sys_recv)(int from, int* sender, char* buf, uint size);
+    void (*sys_disk_submit)(struct disk_request* req);
+    struct disk_request* (*sys_disk_wait)();
     /* Student's code goes here (System Call | Multicore & Locks). */
 
     /* Add interface functions for process sleep or multicore information. */
@@ -43,8 +66,8 @@ extern struct earth* earth;
 extern struct grass* grass;
 
 /* Below is the physical memory layout in egos-2000. */
-#define RAM_END         0x80600000UL /* 6MB memory starting at RAM_START */
-#define APPS_PAGES_BASE 0x80400000UL /* 2MB free for mmu_alloc           */
+#define RAM_END         (earth->ram_end) /* See mmu_init() in cpu_mmu.c  */
+#define APPS_PAGES_BASE 0x80400000UL /* Free for mmu_alloc until RAM_END */
 #define APPS_STACK_TOP  0x80400000UL /* 1MB app stack (growing down)     */
 #define SYSCALL_ARG     0x80301000UL /* struct syscall                   */
 #define APPS_ARG        0x80300000UL /* main() arguments (argc and argv) */
@@ -54,6 +77,10 @@ extern struct grass* grass;
 #define GRASS_STRUCT    0x80101000UL /* struct grass                     */
 #define EARTH_STRUCT    0x80100000UL /* struct earth                     */
 #define RAM_START       0x80000000UL /* 1MB egos code and data           */
+/* Only the memory for mmu_alloc grows with the RAM. The app region is fixed
+ * because every app is linked for it (see library/elf/app.lds), and with
+ * the software TLB it is also the physical memory of the running app, so
+ * more RAM means more processes and cached pages rather than larger apps. */
 
 /* Below is the memory-mapped I/O layout in egos-2000. */
 #define SDHCI_PCI_ECAM   0x30008000UL /* QEMU     */
@@ -61,6 +88,7 @@ extern struct grass* grass;
 #define SDSPI_BASE       0xF0008000UL /* Hardware */
 #define WIFI_BASE        0xF0003000UL /* Hardware */
 #define PLIC_BASE        0x0C000000UL /* QEMU     */
+#define QEMU_TEST_BASE   0x00100000UL /* QEMU     */
 #define ETH_PCI_ECAM     0x30018000UL /* QEMU     */
 #define ETH_BUF_BASE     0x90000000UL /* Hardware */
 #define ETH_CTL_BASE     (earth->platform == QEMU ? 0x41000000UL : 0xF0002000UL)
@@ -69,6 +97,13 @@ extern struct grass* grass;
 #define FLASH_ROM_BASE   (earth->platform == QEMU ? 0x22000000UL : 0x20400000UL)
 #define VIDEO_FRAME_BASE (earth->platform == QEMU ? 0x41000000UL : 0x80600000UL)
 
+/* Below are the PLIC registers for the M-mode context of a core. */
+#define PLIC_PRIORITY(irq)   (irq * 4)
+#define PLIC_ENABLE(core)    (0x2000 + core * 0x100)
+#define PLIC_THRESHOLD(core) (0x200000 + core * 0x2000)
+#define PLIC_CLAIM(core)     (0x200004 + core * 0x2000)
+#define SDHCI_IRQ            33 /* QEMU, PCI slot 1 and INTA */
+
 /* Below are some common macros or declarations for I/O or multicore. */
 #define ACCESS(x)          (*(__typeof__(*x) volatile*)(x))
 #define REGW(base, offset) (ACCESS((uint*)(base + offset)))
@@ -14,13 +14,33 @@
 #define PAGE_SIZE          4096
 #define PAGE_ID_TO_ADDR(x) ((char*)APPS_PAGES_BASE + x * PAGE_SIZE)
 
-void elf_load(int pid, elf_reader reader, int argc, void** argv) {
+static void elf_load_page(elf_reader reader, uint ppage_id, uint blockno,
+                          uint size) {
+    /* Read size bytes from the file to the page and zero the rest. */
+    char* page = PAGE_ID_TO_ADDR(ppage_id);
+    reader(blockno, (size + BLOCK_SIZE - 1) / BLOCK_SIZE, page);
+    memset(page + size, 0, PAGE_SIZE - size);
+}
+
+static char* elf_map_page(elf_mapper mapper, uint blockno, uint size) {
+    /* A whole page in the flash ROM can be mapped instead of copied. */
+    if (!mapper || !earth->mmu_map_rom || size != PAGE_SIZE) return NULL;
+    char* rom = mapper(blockno);
+    return ((uint)rom & (PAGE_SIZE - 1)) ? NULL : rom;
+}
+
+void elf_load(int pid, elf_reader reader, elf_mapper mapper, int ino, int argc,
+              void** argv) {
     /* Load the ELF header. */
-    char hbuf[BLOCK_SIZE], buf[BLOCK_SIZE];
-    reader(0, hbuf);
+    char hbuf[BLOCK_SIZE];
+    reader(0, 1, hbuf);
     struct elf32_header* header          = (void*)hbuf;
     struct elf32_program_header* pheader = (void*)(hbuf + header->e_phoff);
 
+    /* With page tables, the pages loaded from executable file ino are kept in
+     * the page cache and shared by all the processes running this file. */
+    uint shared = (ino >= 0 && earth->translation == PAGE_TABLE);
+
     /* Load the code and data memory regions. */
     for (uint i = 0; i < header->e_phnum; i++) {
         uint addr = pheader[i].p_vaddr;
@@ -31,24 +51,33 @@ void elf_load(int pid, elf_reader reader, int argc, void** argv) {
         uint curr_pageno  = addr / PAGE_SIZE;
         uint end_pageno   = (addr + memsz) / PAGE_SIZE;
         uint curr_blockno = pheader[i].p_offset / BLOCK_SIZE;
-        for (uint ppage_id, off = 0; off < filesz; off += BLOCK_SIZE) {
-            /* Allocate one page (4KB) for every 8 blocks (512 bytes). */
-            if (off % PAGE_SIZE == 0) {
+        /* Writable pages (e.g., the data segment) are copy-on-write. */
+        uint cow = pheader[i].p_flags & PF_W;
+        for (uint off = 0; off < filesz; off += PAGE_SIZE) {
+            uint size = (off + PAGE_SIZE < filesz) ? PAGE_SIZE : (filesz - off);
+            char* rom = cow ? NULL : elf_map_page(mapper, curr_blockno, size);
+            if (rom) {
+                /* Execute the read-only page in place. */
+                earth->mmu_map_rom(pid, curr_pageno++, (uint)rom);
+                curr_blockno += PAGE_SIZE / BLOCK_SIZE;
+                continue;
+            }
+
+            int ppage_id = -1;
+            if (shared) ppage_id = earth->mmu_cache_find(ino, curr_pageno);
+            if (ppage_id < 0) {
                 ppage_id = earth->mmu_alloc();
-                earth->mmu_map(pid, curr_pageno++, ppage_id);
-                memset(PAGE_ID_TO_ADDR(ppage_id), 0, PAGE_SIZE);
+                elf_load_page(reader, ppage_id, curr_blockno, size);
+                if (shared) earth->mmu_cache_add(ino, curr_pageno, ppage_id);
             }
-            uint size =
-                (off + BLOCK_SIZE < filesz) ? BLOCK_SIZE : (filesz - off);
-            reader(curr_blockno++, buf);
-            memcpy(PAGE_ID_TO_ADDR(ppage_id) + (off % PAGE_SIZE), buf, size);
+            shared ? earth->mmu_map_shared(pid, curr_pageno++, ppage_id, cow)
+                   : earth->mmu_map(pid, curr_pageno++, ppage_id);
+            curr_blockno += PAGE_SIZE / BLOCK_SIZE;
         }
 
-        while (curr_pageno <= end_pageno) {
-            uint ppage_id = earth->mmu_alloc();
-            earth->mmu_map(pid, curr_pageno++, ppage_id);
-            memset(PAGE_ID_TO_ADDR(ppage_id), 0, PAGE_SIZE);
-        }
+        /* Zeroed pages are usually ready in a pool (see earth/cpu_mmu.c). */
+        while (curr_pageno <= end_pageno)
+            earth->mmu_map(pid, curr_pageno++, earth->mmu_alloc_zeroed());
 
         /* Numbers printed should match the numbers in build/debug/sys_*.lst. */
         if (pid <= GPID_SHELL) INFO("Load 0x%x bytes to 0x%x", filesz, addr);
@@ -73,9 +102,10 @@ void elf_load(int pid, elf_reader reader, int argc, void** argv) {
     ppage_id = earth->mmu_alloc();
     earth->mmu_map(pid, SYSCALL_ARG / PAGE_SIZE, ppage_id);
 
-    /* Set up 2 pages for the user stack (enough for teaching purposes). */
+    /* Set up 2 pages for the user stack (enough for teaching purposes), and
+     * the stack grows with page faults under page tables (see cpu_mmu.c). */
     for (uint i = 1; i <= 2; i++) {
-        ppage_id = earth->mmu_alloc();
+        ppage_id = earth->mmu_alloc_zeroed();
         earth->mmu_map(pid, APPS_STACK_TOP / PAGE_SIZE - i, ppage_id);
     }
 }
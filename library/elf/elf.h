@@ -27,6 +27,10 @@ struct elf32_program_header {
     uint p_flags;
     uint p_align;
 };
+#define PF_W 0x2 /* p_flags: the segment is writable */
 
-typedef void (*elf_reader)(uint block_no, char* dst);
-void elf_load(int pid, elf_reader reader, int argc, void** argv);
+typedef void (*elf_reader)(uint block_no, uint nblocks, char* dst);
+/* An elf_mapper returns the address of a block in ROM, or NULL. */
+typedef char* (*elf_mapper)(uint block_no);
+void elf_load(int pid, elf_reader reader, elf_mapper mapper, int ino, int argc,
+              void** argv);
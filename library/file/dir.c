@@ -0,0 +1,64 @@
+/*
+ * (C) 2026, Cornell University
+ * All rights reserved.
+ *
+ * Description: the hashed directory format (see dir.h)
+ * tools/mkfs.c builds the directories with dir_add(), and dir_find() looks
+ * up a name for the apps (see library/syscall/servers.c) and for GPID_FILE.
+ */
+
+#ifdef MKFS
+#include <sys/types.h>
+#else
+#include "egos.h"
+#endif
+
+#include "dir.h"
+#include <string.h>
+
+uint dir_hash(char* name) {
+    /* FNV-1a */
+    uint hash = 2166136261u;
+    for (; *name; name++) hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+int dir_add(struct dir_entry* slots, uint nslots, char* name, uint ino) {
+    if (strlen(name) >= DIR_NAME_LEN) return -1;
+
+    for (uint i = 0, hash = dir_hash(name); i < nslots; i++) {
+        struct dir_entry* entry = &slots[(hash + i) % nslots];
+        if (entry == slots) continue; /* slot 0 holds the header */
+        if (!strcmp(entry->name, name)) return -1;
+        if (entry->name[0] == 0) {
+            entry->ino = ino;
+            strcpy(entry->name, name);
+            ((struct dir_header*)slots)->nentries++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int dir_find(dir_reader read, int dir_ino, char* name) {
+    struct dir_entry block[DIR_PER_BLOCK];
+    struct dir_header* header = (void*)block;
+    if (read(dir_ino, 0, (void*)block) < 0 || header->magic != DIR_MAGIC)
+        return -1;
+
+    /* Probe the hash table from the slot of the name. */
+    uint nslots = header->nblocks * DIR_PER_BLOCK, block_no = 0;
+    for (uint i = 0, hash = dir_hash(name); i < nslots; i++) {
+        uint slot = (hash + i) % nslots;
+        if (slot == 0) continue;
+        if (slot / DIR_PER_BLOCK != block_no) {
+            block_no = slot / DIR_PER_BLOCK;
+            if (read(dir_ino, block_no, (void*)block) < 0) return -1;
+        }
+
+        struct dir_entry* entry = &block[slot % DIR_PER_BLOCK];
+        if (entry->name[0] == 0) return -1;
+        if (!strcmp(entry->name, name)) return entry->ino;
+    }
+    return -1;
+}
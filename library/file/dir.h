@@ -0,0 +1,30 @@
+#pragma once
+
+/* A directory is a hash table of fixed-size entries which spans the first
+ * nblocks blocks of its inode. Slot 0 in block 0 holds the dir_header, and
+ * an entry lives in the first free slot from dir_hash(name) % nslots on,
+ * wrapping around, so a lookup reads one or two blocks. The name of a
+ * subdirectory ends with a '/', and an empty slot has an empty name. */
+#include "disk.h"
+
+#define DIR_NAME_LEN  28
+#define DIR_PER_BLOCK (BLOCK_SIZE / sizeof(struct dir_entry))
+#define DIR_MAGIC     0x31524944 /* "DIR1" */
+
+struct dir_entry {
+    uint ino;
+    char name[DIR_NAME_LEN]; /* null-terminated */
+};
+
+struct dir_header {
+    uint magic;
+    uint nblocks;  /* # blocks of the hash table */
+    uint nentries; /* # entries in use */
+    char unused[sizeof(struct dir_entry) - 3 * sizeof(uint)];
+};
+
+typedef int (*dir_reader)(int ino, uint offset, char* block);
+
+uint dir_hash(char* name);
+int dir_add(struct dir_entry* slots, uint nslots, char* name, uint ino);
+int dir_find(dir_reader read, int dir_ino, char* name);
@@ -6,6 +6,20 @@ typedef struct block {
     char bytes[BLOCK_SIZE];
 } block_t;
 
+/* A disk request is submitted with earth->disk_submit() and returned by
+ * earth->disk_complete() after the device has served it. Processes go
+ * through the kernel with grass->sys_disk_submit() and sys_disk_wait(). */
+#define DISK_MAX_NBLOCKS 64
+struct disk_request {
+    enum { DISK_READ, DISK_WRITE } type;
+    uint block_no, nblocks;
+    char* buf;
+    volatile int done;
+    struct disk_request* next;
+    uint start; /* for the statistics in earth/dev_disk.c */
+    int owner;  /* pid of the submitter, or 0 for the kernel */
+};
+
 #define SIZE_2MB             (2 * 1024 * 1024)
 #define EGOS_BIN_DISK_SIZE   SIZE_2MB
 #define FILE_SYS_DISK_SIZE   SIZE_2MB
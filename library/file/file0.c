@@ -3,6 +3,8 @@
  * All rights reserved.
  *
  * Description: a simple (if not naive) file system
+ * Every file is a list of extents (see file0.h), and a multi-block read or
+ * write of a file is one multi-block request below for every extent.
  */
 
 #ifdef MKFS
@@ -14,22 +16,276 @@
 
 #include "inode.h"
 #include <stdlib.h>
-#define DUMMY_DISK_OFFSET(ino, offset) ino * 128 + offset
 
 /* Student's code goes here (File System). */
 
-/* Add a header file similar to file1.h, which defines data structures in your
- * file system. Include this header file and other header files you need, such
- * as string.h. Define helper functions shared by the file system functions. */
+#include "file0.h"
+#include <string.h>
+
+/* The inode blocks and the free bitmap are kept in memory, and written
+ * through to the inode store below upon every update. */
+struct mydisk_state {
+    inode_intf below;
+    uint below_ino;
+    struct mydisk_superblock sb;
+    union mydisk_block* inodeblocks;
+    unsigned char* bitmap;
+    uint bitmap_lo, bitmap_hi; /* bitmap blocks [lo, hi) are not written */
+};
+
+/* Blocks are zeroed or copied up to COPY_NBLOCKS blocks per request. */
+#define COPY_NBLOCKS 8
+static block_t null_blocks[COPY_NBLOCKS], copy_blocks[COPY_NBLOCKS];
+
+#define DATA_START(sb) (1 + (sb)->n_inodeblocks + (sb)->n_bitmapblocks)
+
+static struct mydisk_inode* mydisk_inode(struct mydisk_state* ms, uint ino) {
+    if (ino >= ms->sb.n_inodeblocks * MYDISK_INODES_PER_BLOCK) {
+        printf("mydisk: inode number too large %u\n", ino);
+        return NULL;
+    }
+    return &ms->inodeblocks[ino / MYDISK_INODES_PER_BLOCK]
+                .inodes[ino % MYDISK_INODES_PER_BLOCK];
+}
+
+static int mydisk_sync(struct mydisk_state* ms, uint ino) {
+    inode_intf below = ms->below;
+    uint i           = ino / MYDISK_INODES_PER_BLOCK;
+    if (below->write(below, ms->below_ino, 1 + i,
+                     &ms->inodeblocks[i].datablock) < 0)
+        return -1;
+
+    if (ms->bitmap_lo < ms->bitmap_hi) {
+        block_t* blocks = (block_t*)ms->bitmap;
+        if (inode_writev(below, ms->below_ino,
+                         1 + ms->sb.n_inodeblocks + ms->bitmap_lo,
+                         ms->bitmap_hi - ms->bitmap_lo,
+                         &blocks[ms->bitmap_lo]) < 0)
+            return -1;
+        ms->bitmap_lo = ms->sb.n_bitmapblocks;
+        ms->bitmap_hi = 0;
+    }
+    return 0;
+}
+
+static int block_in_use(struct mydisk_state* ms, uint b) {
+    return ms->bitmap[b / 8] & (1 << (b % 8));
+}
+
+static void mark_blocks(struct mydisk_state* ms, uint start, uint n,
+                        uint used) {
+    for (uint b = start; b < start + n; b++)
+        if (used)
+            ms->bitmap[b / 8] |= 1 << (b % 8);
+        else
+            ms->bitmap[b / 8] &= ~(1 << (b % 8));
+
+    uint lo = start / MYDISK_BITS_PER_BLOCK;
+    uint hi = (start + n - 1) / MYDISK_BITS_PER_BLOCK + 1;
+    if (lo < ms->bitmap_lo) ms->bitmap_lo = lo;
+    if (hi > ms->bitmap_hi) ms->bitmap_hi = hi;
+}
+
+/* Allocate the first run of at least min and at most n free blocks at or
+ * after hint, wrapping around at the end, and return its start and length. */
+static uint alloc_run(struct mydisk_state* ms, uint hint, uint min, uint n,
+                      uint* length) {
+    uint first = DATA_START(&ms->sb), ndata = ms->sb.nblocks - first;
+    if (hint < first || hint >= ms->sb.nblocks) hint = first;
+
+    for (uint i = 0; i < ndata; i++) {
+        uint b = first + (hint - first + i) % ndata;
+        if (ms->bitmap[b / 8] == 0xFF && b % 8 == 0 &&
+            b + 8 <= ms->sb.nblocks) {
+            i += 7;
+            continue;
+        }
+        if (block_in_use(ms, b)) continue;
+
+        uint len = 1;
+        while (len < n && b + len < ms->sb.nblocks &&
+               !block_in_use(ms, b + len))
+            len++;
+        if (len < min) {
+            i += len - 1;
+            continue;
+        }
+        mark_blocks(ms, b, len, 1);
+        *length = len;
+        return b;
+    }
+    *length = 0;
+    return 0;
+}
+
+/* Map block offset of a file to a block below, and return in *run the
+ * number of blocks from there to the end of its extent. */
+static uint map_block(struct mydisk_inode* inode, uint offset, uint* run) {
+    for (uint i = 0;; i++) {
+        struct mydisk_extent* e = &inode->extents[i];
+        if (offset < e->length) {
+            *run = e->length - offset;
+            return e->start + offset;
+        }
+        offset -= e->length;
+    }
+}
+
+/* Read or write nblocks blocks of a file with one request per extent. */
+static int access_blocks(struct mydisk_state* ms, struct mydisk_inode* inode,
+                         uint offset, uint nblocks, block_t* blocks,
+                         uint write) {
+    while (nblocks > 0) {
+        uint run, b = map_block(inode, offset, &run);
+        if (run > nblocks) run = nblocks;
+
+        int r = write ? inode_writev(ms->below, ms->below_ino, b, run, blocks)
+                      : inode_readv(ms->below, ms->below_ino, b, run, blocks);
+        if (r < 0) return -1;
+        offset += run;
+        nblocks -= run;
+        blocks += run;
+    }
+    return 0;
+}
+
+/* Move a file which runs out of extents to one extent of nblocks blocks. */
+static int relocate(struct mydisk_state* ms, struct mydisk_inode* inode,
+                    uint nblocks) {
+    uint length, start = alloc_run(ms, 0, nblocks, nblocks, &length);
+    if (length == 0) {
+        printf("mydisk: no room for %u contiguous blocks\n", nblocks);
+        return -1;
+    }
+
+    /* Copy the file before freeing its old extents, so that the file stays
+     * as it is if the copy fails. */
+    for (uint offset = 0, n; offset < inode->nblocks; offset += n) {
+        n = inode->nblocks - offset;
+        if (n > COPY_NBLOCKS) n = COPY_NBLOCKS;
+        if (access_blocks(ms, inode, offset, n, copy_blocks, 0) < 0 ||
+            inode_writev(ms->below, ms->below_ino, start + offset, n,
+                         copy_blocks) < 0) {
+            mark_blocks(ms, start, length, 0);
+            return -1;
+        }
+    }
+    for (uint i = 0; i < inode->nextents; i++)
+        mark_blocks(ms, inode->extents[i].start, inode->extents[i].length, 0);
+    inode->nextents   = 1;
+    inode->extents[0] = (struct mydisk_extent){start, length};
+    inode->nblocks    = nblocks;
+    return 0;
+}
+
+/* Add blocks to the end of a file, extending its last extent in place if
+ * the next blocks are free, or else preferring a new extent which holds all
+ * the new blocks. The new blocks are not initialized, and the caller should
+ * shrink the file back to its old size upon failure. */
+static int grow(struct mydisk_state* ms, struct mydisk_inode* inode,
+                uint nblocks) {
+    while (inode->nblocks < nblocks) {
+        struct mydisk_extent* last =
+            inode->nextents ? &inode->extents[inode->nextents - 1] : NULL;
+        uint hint = last ? last->start + last->length : 0;
+        uint n    = nblocks - inode->nblocks, length, start;
+
+        if (last && hint < ms->sb.nblocks && !block_in_use(ms, hint)) {
+            start = alloc_run(ms, hint, 1, n, &length);
+        } else if (inode->nextents == MYDISK_NEXTENTS) {
+            return relocate(ms, inode, nblocks);
+        } else {
+            start = alloc_run(ms, hint, n, n, &length);
+            if (length == 0) start = alloc_run(ms, hint, 1, n, &length);
+        }
+        if (length == 0) {
+            printf("mydisk: the disk is full\n");
+            return -1;
+        }
+
+        if (last && start == last->start + last->length)
+            last->length += length;
+        else
+            inode->extents[inode->nextents++] =
+                (struct mydisk_extent){start, length};
+        inode->nblocks += length;
+    }
+    return 0;
+}
+
+/* Free the blocks of a file from the end down to nblocks. */
+static void shrink(struct mydisk_state* ms, struct mydisk_inode* inode,
+                   uint nblocks) {
+    while (inode->nblocks > nblocks) {
+        struct mydisk_extent* last = &inode->extents[inode->nextents - 1];
+        uint n                     = inode->nblocks - nblocks;
+        if (n > last->length) n = last->length;
+
+        mark_blocks(ms, last->start + last->length - n, n, 0);
+        last->length -= n;
+        inode->nblocks -= n;
+        if (last->length == 0) inode->nextents--;
+    }
+}
+
+/* Fill blocks [from, to) of a file with null bytes. */
+static int zero_blocks(struct mydisk_state* ms, struct mydisk_inode* inode,
+                       uint from, uint to) {
+    for (uint offset = from, n; offset < to; offset += n) {
+        n = to - offset;
+        if (n > COPY_NBLOCKS) n = COPY_NBLOCKS;
+        if (access_blocks(ms, inode, offset, n, null_blocks, 1) < 0) return -1;
+    }
+    return 0;
+}
 
 /* Student's code ends here. */
 
+int mydisk_readv(inode_intf self, uint ino, uint offset, uint nblocks,
+                 block_t* blocks) {
+    /* Student's code goes here (File System). */
+
+    struct mydisk_state* ms    = self->state;
+    struct mydisk_inode* inode = mydisk_inode(ms, ino);
+    if (inode == NULL) return -1;
+
+    if (offset + nblocks > inode->nblocks) {
+        printf("mydisk: offset too large %u %u\n", offset + nblocks - 1,
+               inode->nblocks);
+        return -1;
+    }
+    return access_blocks(ms, inode, offset, nblocks, blocks, 0);
+
+    /* Student's code ends here. */
+}
+
+int mydisk_writev(inode_intf self, uint ino, uint offset, uint nblocks,
+                  block_t* blocks) {
+    /* Student's code goes here (File System). */
+
+    struct mydisk_state* ms    = self->state;
+    struct mydisk_inode* inode = mydisk_inode(ms, ino);
+    if (inode == NULL) return -1;
+
+    /* Writing past the end of a file fills the gap with null bytes. */
+    uint old_nblocks = inode->nblocks;
+    if (offset + nblocks > old_nblocks) {
+        if (grow(ms, inode, offset + nblocks) < 0 ||
+            zero_blocks(ms, inode, old_nblocks, offset) < 0) {
+            shrink(ms, inode, old_nblocks);
+            return -1;
+        }
+        if (mydisk_sync(ms, ino) < 0) return -1;
+    }
+    return access_blocks(ms, inode, offset, nblocks, blocks, 1);
+
+    /* Student's code ends here. */
+}
+
 int mydisk_read(inode_intf self, uint ino, uint offset, block_t* block) {
     /* Student's code goes here (File System). */
 
-    /* Replace the code below with your own file system read logic. */
-    inode_intf below = self->state;
-    return below->read(below, 0, DUMMY_DISK_OFFSET(ino, offset), block);
+    return mydisk_readv(self, ino, offset, 1, block);
 
     /* Student's code ends here. */
 }
@@ -37,9 +293,7 @@ int mydisk_read(inode_intf self, uint ino, uint offset, block_t* block) {
 int mydisk_write(inode_intf self, uint ino, uint offset, block_t* block) {
     /* Student's code goes here (File System). */
 
-    /* Replace the code below with your own file system write logic. */
-    inode_intf below = self->state;
-    return below->write(below, 0, DUMMY_DISK_OFFSET(ino, offset), block);
+    return mydisk_writev(self, ino, offset, 1, block);
 
     /* Student's code ends here. */
 }
@@ -47,33 +301,70 @@ int mydisk_write(inode_intf self, uint ino, uint offset, block_t* block) {
 int mydisk_getsize(inode_intf self, uint ino) {
     /* Student's code goes here (File System). */
 
-    /* Replace the error printing with code for getting an inode's size. */
-#ifdef MKFS
-    fprintf(stderr, "mydisk_getsize not implemented");
-    while (1);
-#else
-    FATAL("mydisk_getsize not implemented");
-#endif
+    struct mydisk_inode* inode = mydisk_inode(self->state, ino);
+    return inode ? inode->nblocks : -1;
+
     /* Student's code ends here. */
 }
 
 int mydisk_setsize(inode_intf self, uint ino, uint nblocks) {
     /* Student's code goes here (File System). */
 
-    /* Replace the error printing with code for changing an inode's size. */
-#ifdef MKFS
-    fprintf(stderr, "mydisk_setsize not implemented");
-    while (1);
-#else
-    FATAL("mydisk_setsize not implemented");
-#endif
+    struct mydisk_state* ms    = self->state;
+    struct mydisk_inode* inode = mydisk_inode(ms, ino);
+    if (inode == NULL) return -1;
+
+    uint old_nblocks = inode->nblocks;
+    if (nblocks < old_nblocks) {
+        shrink(ms, inode, nblocks);
+    } else if (grow(ms, inode, nblocks) < 0 ||
+               zero_blocks(ms, inode, old_nblocks, nblocks) < 0) {
+        shrink(ms, inode, old_nblocks);
+        return -1;
+    }
+    return (mydisk_sync(ms, ino) < 0) ? -1 : old_nblocks;
+
     /* Student's code ends here. */
 }
 
 int mydisk_create(inode_intf below, uint below_ino, uint ninodes) {
     /* Student's code goes here (File System). */
 
-    /* Create the initial on-disk data structures for your file system. */
+    /* Check whether a file system already exists. */
+    union mydisk_block block;
+    if (below->read(below, below_ino, 0, &block.datablock) < 0) return -1;
+    if (block.superblock.n_inodeblocks != 0) return 0;
+
+    struct mydisk_superblock sb;
+    sb.nblocks        = below->getsize(below, below_ino);
+    sb.n_inodeblocks  = (ninodes + MYDISK_INODES_PER_BLOCK - 1) /
+                       MYDISK_INODES_PER_BLOCK;
+    sb.n_bitmapblocks = (sb.nblocks + MYDISK_BITS_PER_BLOCK - 1) /
+                        MYDISK_BITS_PER_BLOCK;
+    if (sb.nblocks <= DATA_START(&sb)) {
+        printf("mydisk: too few blocks\n");
+        return -1;
+    }
+
+    /* All the data blocks are free, so that files become single extents. */
+    for (uint i = 0; i < sb.n_bitmapblocks; i++) {
+        memset(&block, 0, BLOCK_SIZE);
+        for (uint j = 0; j < MYDISK_BITS_PER_BLOCK; j++) {
+            uint b = i * MYDISK_BITS_PER_BLOCK + j;
+            if (b < DATA_START(&sb) || b >= sb.nblocks)
+                block.bitmap[j / 8] |= 1 << (j % 8);
+        }
+        if (below->write(below, below_ino, 1 + sb.n_inodeblocks + i,
+                         &block.datablock) < 0)
+            return -1;
+    }
+
+    for (uint i = 1; i <= sb.n_inodeblocks; i++)
+        if (below->write(below, below_ino, i, null_blocks) < 0) return -1;
+
+    memset(&block, 0, BLOCK_SIZE);
+    block.superblock = sb;
+    if (below->write(below, below_ino, 0, &block.datablock) < 0) return -1;
 
     /* Student's code ends here. */
     return 0;
@@ -82,13 +373,42 @@ int mydisk_create(inode_intf below, uint below_ino, uint ninodes) {
 inode_intf mydisk_init(inode_intf below, uint below_ino) {
     /* Student's code goes here (File System). */
 
-    /* Feel free to add or modify anything here. */
-    inode_intf self = malloc(sizeof(struct inode_store));
+    /* Read the superblock, the inode blocks and the free bitmap. */
+    union mydisk_block block;
+    if (below->read(below, below_ino, 0, &block.datablock) < 0) return NULL;
+
+    struct mydisk_state* ms = malloc(sizeof(struct mydisk_state));
+    inode_intf self         = malloc(sizeof(struct inode_store));
+    if (ms) {
+        ms->below       = below;
+        ms->below_ino   = below_ino;
+        ms->sb          = block.superblock;
+        ms->inodeblocks = malloc(ms->sb.n_inodeblocks * BLOCK_SIZE);
+        ms->bitmap      = malloc(ms->sb.n_bitmapblocks * BLOCK_SIZE);
+        ms->bitmap_lo   = ms->sb.n_bitmapblocks;
+        ms->bitmap_hi   = 0;
+    }
+    if (!ms || !self || !ms->inodeblocks || !ms->bitmap ||
+        inode_readv(below, below_ino, 1, ms->sb.n_inodeblocks,
+                    (block_t*)ms->inodeblocks) < 0 ||
+        inode_readv(below, below_ino, 1 + ms->sb.n_inodeblocks,
+                    ms->sb.n_bitmapblocks, (block_t*)ms->bitmap) < 0) {
+        if (ms) {
+            free(ms->inodeblocks);
+            free(ms->bitmap);
+        }
+        free(ms);
+        free(self);
+        return NULL;
+    }
+
     self->getsize   = mydisk_getsize;
     self->setsize   = mydisk_setsize;
     self->read      = mydisk_read;
     self->write     = mydisk_write;
-    self->state     = below;
+    self->readv     = mydisk_readv;
+    self->writev    = mydisk_writev;
+    self->state     = ms;
     return self;
     /* Student's code ends here. */
 }
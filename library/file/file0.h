@@ -0,0 +1,43 @@
+/*
+ * (C) 2026, Cornell University
+ * All rights reserved.
+ *
+ * Description: the layout of the mydisk file system
+ * Block 0 is the superblock, followed by the inode blocks, the blocks of the
+ * free bitmap, and the data blocks. An inode maps the blocks of a file, in
+ * order, to at most MYDISK_NEXTENTS extents of contiguous blocks, so that a
+ * file written in sequence is usually one extent.
+ */
+
+#pragma once
+#include "inode.h"
+
+#define MYDISK_NEXTENTS         7
+#define MYDISK_INODES_PER_BLOCK (BLOCK_SIZE / sizeof(struct mydisk_inode))
+#define MYDISK_BITS_PER_BLOCK   (BLOCK_SIZE * 8)
+
+struct mydisk_superblock {
+    uint n_inodeblocks;  /* # blocks with inodes */
+    uint n_bitmapblocks; /* # blocks of the free bitmap */
+    uint nblocks;        /* # blocks in the file system */
+};
+
+struct mydisk_extent {
+    uint start, length; /* blocks [start, start + length) */
+};
+
+/* The lengths of the extents in use add up to the size of the file. */
+struct mydisk_inode {
+    uint nblocks;  /* size of the file in blocks */
+    uint nextents; /* # extents in use */
+    struct mydisk_extent extents[MYDISK_NEXTENTS];
+};
+
+/* Bit i of byte j in the bitmap is 1 if block 8 * j + i is in use, and the
+ * blocks before the data blocks and past the end are always in use. */
+union mydisk_block {
+    block_t datablock;
+    struct mydisk_superblock superblock;
+    struct mydisk_inode inodes[MYDISK_INODES_PER_BLOCK];
+    unsigned char bitmap[BLOCK_SIZE];
+};
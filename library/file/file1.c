@@ -41,18 +41,44 @@
  * Convenient for all operations. See "file1.h" for field details.
  */
 struct treedisk_snapshot {
-    union treedisk_block superblock;
-    union treedisk_block inodeblock;
+    union treedisk_block* superblock;
+    union treedisk_block* inodeblock;
     block_no inode_blockno;
     struct treedisk_inode* inode;
 };
 
 /* The state of a virtual inode store, which is identified by an inode number.
+ * It caches the superblock, the free bitmap, and recently used inode blocks,
+ * which are written through to the inode store below upon every update.
+ */
+#define TREEDISK_NCACHED  4 /* number of inode blocks cached */
+#define TREEDISK_NCURSORS 4 /* number of inodes with a cursor */
+#define TREEDISK_NLEVELS  3 /* number of indirect levels in a cursor */
+
+/* A cursor remembers the indirect blocks on the last path walked down the
+ * tree of an inode, indexed by height (0 = the parent of the data blocks).
+ * Sequential reads under the same parent then only read the data block, and
+ * sequential writes update the parent once at the end of treedisk_writev().
  */
+struct treedisk_cursor {
+    uint ino;
+    uint dirty; /* bit h is set if path[h] is not written below yet */
+    block_no path_nos[TREEDISK_NLEVELS]; /* 0 means an empty entry */
+    union treedisk_block path[TREEDISK_NLEVELS];
+};
+
 struct treedisk_state {
     inode_intf below; /* inode store below */
     uint below_ino;   /* inode number to use for the inode store below */
     uint ninodes;     /* number of inodes in the treedisk */
+    union treedisk_block superblock;
+    union treedisk_block inodeblocks[TREEDISK_NCACHED];
+    block_no inodeblock_nos[TREEDISK_NCACHED]; /* 0 means an empty entry */
+    struct treedisk_cursor cursors[TREEDISK_NCURSORS];
+    unsigned char* bitmap; /* the free bitmap, read with the superblock */
+    block_no bitmap_lo;    /* bitmap blocks in [lo, hi) are not written yet */
+    block_no bitmap_hi;
+    block_no alloc_next; /* block after the last one allocated */
 };
 
 static uint log_rpb;       /* log2(REFS_PER_BLOCK) */
@@ -77,82 +103,178 @@ static block_no log_shift_r(block_no x, uint nbits) {
     return x >> nbits;
 }
 
+/* Read the superblock and the free bitmap into ts.
+ */
+static int treedisk_get_superblock(struct treedisk_state* ts) {
+    struct treedisk_superblock* sb = &ts->superblock.superblock;
+    if ((*ts->below->read)(ts->below, ts->below_ino, 0,
+                           (block_t*)&ts->superblock) < 0)
+        return -1;
+    if (sb->n_inodeblocks == 0) return 0;
+
+    ts->bitmap = malloc(sb->n_bitmapblocks * BLOCK_SIZE);
+    if (ts->bitmap == NULL) return -1;
+    if (inode_readv(ts->below, ts->below_ino, 1 + sb->n_inodeblocks,
+                    sb->n_bitmapblocks, (block_t*)ts->bitmap) < 0) {
+        free(ts->bitmap);
+        ts->bitmap = NULL;
+        return -1;
+    }
+    ts->bitmap_lo  = sb->n_bitmapblocks;
+    ts->bitmap_hi  = 0;
+    ts->alloc_next = 1 + sb->n_inodeblocks + sb->n_bitmapblocks;
+    return 0;
+}
+
 /* Get a snapshot of the file system, including the superblock and the block
- * containing the inode, from the inode store below.
+ * containing the inode, from the cache in ts or else the inode store below.
  */
 static int treedisk_get_snapshot(struct treedisk_snapshot* snapshot,
                                  struct treedisk_state* ts, uint inode_no) {
-    /* Get the superblock.
+    /* Get the superblock, which is read once a file system exists.
      */
-    if ((*ts->below->read)(ts->below, ts->below_ino, 0,
-                           (block_t*)&snapshot->superblock) < 0)
-        return -1;
+    snapshot->superblock = &ts->superblock;
+    if (ts->bitmap == NULL && treedisk_get_superblock(ts) < 0) return -1;
 
     /* Check the inode number.
      */
     if (inode_no >=
-        snapshot->superblock.superblock.n_inodeblocks * INODES_PER_BLOCK) {
+        snapshot->superblock->superblock.n_inodeblocks * INODES_PER_BLOCK) {
         printf("!!TDERR: inode number too large %u %u\n", inode_no,
-               snapshot->superblock.superblock.n_inodeblocks);
+               snapshot->superblock->superblock.n_inodeblocks);
         return -1;
     }
 
     /* Find the inode.
      */
     snapshot->inode_blockno = 1 + inode_no / INODES_PER_BLOCK;
-    if ((*ts->below->read)(ts->below, ts->below_ino, snapshot->inode_blockno,
-                           (block_t*)&snapshot->inodeblock) < 0)
-        return -1;
+    uint slot               = snapshot->inode_blockno % TREEDISK_NCACHED;
+    snapshot->inodeblock    = &ts->inodeblocks[slot];
+    if (ts->inodeblock_nos[slot] != snapshot->inode_blockno) {
+        ts->inodeblock_nos[slot] = 0;
+        if ((*ts->below->read)(ts->below, ts->below_ino,
+                               snapshot->inode_blockno,
+                               (block_t*)snapshot->inodeblock) < 0)
+            return -1;
+        ts->inodeblock_nos[slot] = snapshot->inode_blockno;
+    }
 
     snapshot->inode =
-        &snapshot->inodeblock.inodeblock.inodes[inode_no % INODES_PER_BLOCK];
+        &snapshot->inodeblock->inodeblock.inodes[inode_no % INODES_PER_BLOCK];
     return 0;
 }
 
-/* Allocate a block from the free list.
+/* Write back the updated indirect blocks in a cursor.
  */
-static block_no treedisk_alloc_block(struct treedisk_state* ts,
-                                     struct treedisk_snapshot* snapshot) {
-    block_no b;
+static void treedisk_flush_cursor(struct treedisk_state* ts,
+                                  struct treedisk_cursor* cursor) {
+    for (uint h = 0; cursor->dirty != 0; h++)
+        if (cursor->dirty & (1 << h)) {
+            if ((*ts->below->write)(ts->below, ts->below_ino,
+                                    cursor->path_nos[h],
+                                    (block_t*)&cursor->path[h]) < 0)
+                panic("treedisk_flush_cursor");
+            cursor->dirty &= ~(1 << h);
+        }
+}
 
-    if ((b = snapshot->superblock.superblock.free_list) == 0)
-        panic("treedisk_alloc_block: inode store is full\n");
+/* Get the cursor of an inode, taking over the slot of another inode.
+ */
+static struct treedisk_cursor* treedisk_get_cursor(struct treedisk_state* ts,
+                                                   uint inode_no) {
+    struct treedisk_cursor* cursor;
+    cursor = &ts->cursors[inode_no % TREEDISK_NCURSORS];
+    if (cursor->ino != inode_no) {
+        treedisk_flush_cursor(ts, cursor);
+        cursor->ino = inode_no;
+        memset(cursor->path_nos, 0, sizeof(cursor->path_nos));
+    }
+    return cursor;
+}
 
-    /* Read the freelist block and scan for a free block reference.
-     */
-    union treedisk_block freelistblock;
-    if ((*ts->below->read)(ts->below, ts->below_ino, b,
-                           (block_t*)&freelistblock) < 0) {
-        panic("treedisk_alloc_block");
+/* Put block b at height h of the cursor, reading it from below unless it is
+ * a new block.  The block it replaces is written back first if updated.
+ */
+static int treedisk_load_cursor(struct treedisk_state* ts,
+                                struct treedisk_cursor* cursor, uint h,
+                                block_no b, uint new_block) {
+    if (cursor->path_nos[h] == b) return 0;
+    if (cursor->dirty & (1 << h)) {
+        if ((*ts->below->write)(ts->below, ts->below_ino, cursor->path_nos[h],
+                                (block_t*)&cursor->path[h]) < 0)
+            return -1;
+        cursor->dirty &= ~(1 << h);
     }
-    uint i;
-    for (i = REFS_PER_BLOCK; --i > 0;)
-        if (freelistblock.freelistblock.refs[i] != 0) {
-            break;
-        }
 
-    /* If there is a free block reference use that.  Otherwise use
-     * the free list block itself and update the superblock.
-     */
-    block_no free_blockno;
-    if (i == 0) {
-        free_blockno = b;
-        snapshot->superblock.superblock.free_list =
-            freelistblock.freelistblock.refs[0];
-        if ((*ts->below->write)(ts->below, ts->below_ino, 0,
-                                (block_t*)&snapshot->superblock) < 0) {
-            panic("treedisk_alloc_block: superblock");
+    cursor->path_nos[h] = 0;
+    if (new_block)
+        memset(&cursor->path[h], 0, BLOCK_SIZE);
+    else if ((*ts->below->read)(ts->below, ts->below_ino, b,
+                                (block_t*)&cursor->path[h]) < 0)
+        return -1;
+    cursor->path_nos[h] = b;
+    return 0;
+}
+
+/* Mark block b in use or free in the free bitmap, which is written to the
+ * inode store below by treedisk_sync_bitmap().
+ */
+static void treedisk_mark_block(struct treedisk_state* ts, block_no b,
+                                uint used) {
+    if (used)
+        ts->bitmap[b / 8] |= 1 << (b % 8);
+    else
+        ts->bitmap[b / 8] &= ~(1 << (b % 8));
+
+    block_no i = b / BITS_PER_BLOCK;
+    if (i < ts->bitmap_lo) ts->bitmap_lo = i;
+    if (i >= ts->bitmap_hi) ts->bitmap_hi = i + 1;
+}
+
+/* Write the updated bitmap blocks with one inode_writev().
+ */
+static void treedisk_sync_bitmap(struct treedisk_state* ts) {
+    if (ts->bitmap_lo >= ts->bitmap_hi) return;
+
+    struct treedisk_superblock* sb = &ts->superblock.superblock;
+    block_t* blocks                = (block_t*)ts->bitmap;
+    if (inode_writev(ts->below, ts->below_ino,
+                     1 + sb->n_inodeblocks + ts->bitmap_lo,
+                     ts->bitmap_hi - ts->bitmap_lo,
+                     &blocks[ts->bitmap_lo]) < 0)
+        panic("treedisk_sync_bitmap");
+    ts->bitmap_lo = sb->n_bitmapblocks;
+    ts->bitmap_hi = 0;
+}
+
+/* Allocate the first free block at or after 'hint', wrapping around at the
+ * end, so that the blocks written in sequence are laid out in sequence.
+ */
+static block_no treedisk_alloc_block(struct treedisk_state* ts,
+                                     block_no hint) {
+    struct treedisk_superblock* sb = &ts->superblock.superblock;
+    block_no first                 = 1 + sb->n_inodeblocks + sb->n_bitmapblocks;
+    block_no ndata                 = sb->nblocks - first;
+    if (hint < first || hint >= sb->nblocks) hint = first;
+
+    for (block_no i = 0; i < ndata; i++) {
+        block_no b = first + (hint - first + i) % ndata;
+
+        /* Skip the 8 blocks of a full byte at once.
+         */
+        if (ts->bitmap[b / 8] == 0xFF && b % 8 == 0 && b + 8 <= sb->nblocks) {
+            i += 7;
+            continue;
         }
-    } else {
-        free_blockno = freelistblock.freelistblock.refs[i];
-        freelistblock.freelistblock.refs[i] = 0;
-        if ((*ts->below->write)(ts->below, ts->below_ino, b,
-                                (block_t*)&freelistblock) < 0) {
-            panic("treedisk_alloc_block: freelistblock");
+        if ((ts->bitmap[b / 8] & (1 << (b % 8))) == 0) {
+            treedisk_mark_block(ts, b, 1);
+            ts->alloc_next = b + 1;
+            return b;
         }
     }
 
-    return free_blockno;
+    panic("treedisk_alloc_block: inode store is full\n");
+    return 0;
 }
 
 /* Retrieve the number of blocks in the file referenced by 'self'.  This
@@ -166,11 +288,47 @@ static int treedisk_getsize(inode_intf self, uint ino) {
     return snapshot.inode->nblocks;
 }
 
-/* Set the size of the file 'self' to 'nblocks'.
+/* Find the block below which holds the block at 'offset' in *result, or 0
+ * for a hole, by walking down from the root block.  The indirect blocks are
+ * taken from the cursor when they are on the last path walked.
  */
-static int treedisk_setsize(inode_intf self, uint ino, block_no nblocks) {
-    panic("treedisk_setsize not implemented");
-    return -1;
+static int treedisk_lookup(struct treedisk_state* ts,
+                           struct treedisk_snapshot* snapshot, uint ino,
+                           block_no offset, block_no* result) {
+    /* Figure out how many levels there are in the tree.
+     */
+    uint nlevels = 0;
+    if (snapshot->inode->nblocks > 0)
+        while (log_shift_r(snapshot->inode->nblocks - 1, nlevels * log_rpb) !=
+               0) {
+            nlevels++;
+        }
+
+    struct treedisk_cursor* cursor = treedisk_get_cursor(ts, ino);
+    union treedisk_block indirblock;
+    block_no b = snapshot->inode->root;
+    for (; b != 0 && nlevels > 0; nlevels--) {
+        /* Get the indirect block at this level.
+         */
+        union treedisk_block* tib = &indirblock;
+        if (nlevels <= TREEDISK_NLEVELS) {
+            tib = &cursor->path[nlevels - 1];
+            if (treedisk_load_cursor(ts, cursor, nlevels - 1, b, 0) < 0)
+                return -1;
+        } else if ((*ts->below->read)(ts->below, ts->below_ino, b,
+                                      (block_t*)tib) < 0) {
+            return -1;
+        }
+
+        /* Figure out the index into this block and get the block number.
+         */
+        uint index =
+            log_shift_r(offset, (nlevels - 1) * log_rpb) % REFS_PER_BLOCK;
+        b = tib->indirblock.refs[index];
+    }
+
+    *result = b;
+    return 0;
 }
 
 /* Read a block at the given block number 'offset' and return in *block.
@@ -192,102 +350,167 @@ static int treedisk_read(inode_intf self, uint ino, block_no offset,
         return -1;
     }
 
-    /* Figure out how many levels there are in the tree.
-     */
-    uint nlevels = 0;
-    if (snapshot.inode->nblocks > 0)
-        while (log_shift_r(snapshot.inode->nblocks - 1, nlevels * log_rpb) !=
-               0) {
-            nlevels++;
-        }
+    block_no b;
+    if (treedisk_lookup(ts, &snapshot, ino, offset, &b) < 0) return -1;
 
-    /* Walk down from the root block.
+    /* If there's a hole, return the null block.
      */
-    block_no b = snapshot.inode->root;
-    for (;;) {
-        /* If there's a hole, return the null block.
+    if (b == 0) {
+        memset(block, 0, BLOCK_SIZE);
+        return 0;
+    }
+    return (*ts->below->read)(ts->below, ts->below_ino, b, block);
+}
+
+/* Read 'nblocks' blocks from the given block number 'offset' into blocks[],
+ * passing every run of contiguous blocks below to one inode_readv().
+ */
+static int treedisk_readv(inode_intf self, uint ino, block_no offset,
+                          uint nblocks, block_t* blocks) {
+    struct treedisk_state* ts = self->state;
+
+    struct treedisk_snapshot snapshot;
+    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0) return -1;
+
+    if (offset + nblocks > snapshot.inode->nblocks) {
+        printf("!!TDERR: offset too large %u %u\n", offset + nblocks - 1,
+               snapshot.inode->nblocks);
+        return -1;
+    }
+
+    block_no run_start = 0;
+    uint run_len       = 0;
+    for (uint i = 0; i <= nblocks; i++) {
+        block_no b = 0;
+        if (i < nblocks &&
+            treedisk_lookup(ts, &snapshot, ino, offset + i, &b) < 0)
+            return -1;
+
+        /* Read the current run once block b does not extend it.
          */
+        if (run_len > 0 && (i == nblocks || b != run_start + run_len)) {
+            if (inode_readv(ts->below, ts->below_ino, run_start, run_len,
+                            &blocks[i - run_len]) < 0)
+                return -1;
+            run_len = 0;
+        }
+        if (i == nblocks) break;
+
         if (b == 0) {
-            memset(block, 0, BLOCK_SIZE);
-            return 0;
+            memset(&blocks[i], 0, BLOCK_SIZE);
+        } else if (run_len++ == 0) {
+            run_start = b;
         }
+    }
+    return 0;
+}
 
-        /* Return the next level.  If the last level, we're done.
+/* Find the block below which holds the block at 'offset', allocating it
+ * (and indirect blocks) if necessary.  The indirect blocks on the path are
+ * kept in the cursor, and a new block is placed right after its left
+ * sibling if there is one, or else after its parent.
+ */
+static block_no treedisk_alloc_path(struct treedisk_state* ts,
+                                    struct treedisk_snapshot* snapshot,
+                                    struct treedisk_cursor* cursor,
+                                    uint nlevels, block_no offset) {
+    union treedisk_block indirblock;
+    block_no b;
+    block_no hint                = ts->alloc_next;
+    block_no* parent_no          = &snapshot->inode->root;
+    block_no parent_off          = snapshot->inode_blockno;
+    union treedisk_block* parent = snapshot->inodeblock;
+    uint parent_dirty            = 0;
+    for (;;) {
+        /* Get or allocate the next block.  A parent in the cursor is
+         * written back later by treedisk_flush_cursor().
          */
-        int result = (*ts->below->read)(ts->below, ts->below_ino, b, block);
-        if (result < 0) return result;
-        if (nlevels == 0) return 0;
+        uint new_block = 0;
+        if ((b = *parent_no) == 0) {
+            b = *parent_no = treedisk_alloc_block(ts, hint);
+            new_block      = 1;
+            if (parent_dirty)
+                cursor->dirty |= parent_dirty;
+            else if ((*ts->below->write)(ts->below, ts->below_ino, parent_off,
+                                         (block_t*)parent) < 0)
+                panic("treedisk_write: parent");
+        }
+        if (nlevels == 0) return b;
+
+        union treedisk_block* tib = &indirblock;
+        parent_dirty              = 0;
+        if (nlevels <= TREEDISK_NLEVELS) {
+            tib          = &cursor->path[nlevels - 1];
+            parent_dirty = 1 << (nlevels - 1);
+            if (treedisk_load_cursor(ts, cursor, nlevels - 1, b, new_block) < 0)
+                panic("treedisk_write");
+        } else if (new_block) {
+            memset(tib, 0, BLOCK_SIZE);
+        } else if ((*ts->below->read)(ts->below, ts->below_ino, b,
+                                      (block_t*)tib) < 0) {
+            panic("treedisk_write");
+        }
 
-        /* The block is an indirect block.  Figure out the index into this
-         * block and get the block number.
+        /* Figure out the index into this block and get the block number.
          */
         nlevels--;
-        struct treedisk_indirblock* tib = (struct treedisk_indirblock*)block;
         uint index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
-        b          = tib->refs[index];
+        parent_no  = &tib->indirblock.refs[index];
+        hint       = (index > 0 && parent_no[-1] != 0) ? parent_no[-1] + 1
+                                                       : b + 1;
+        parent     = tib;
+        parent_off = b;
     }
-    return 0;
 }
 
-/* Write *block at the given block number 'offset'.
+/* Return the number of levels of indirect blocks in a file of 'nblocks'.
  */
-static int treedisk_write(inode_intf self, uint ino, block_no offset,
-                          block_t* block) {
-    struct treedisk_state* ts = self->state;
-    uint dirty_inode          = 0;
-
-    /* Get info from underlying file system.
-     */
-    struct treedisk_snapshot snapshot_buffer;
-    struct treedisk_snapshot* snapshot = &snapshot_buffer;
-    if (treedisk_get_snapshot(snapshot, ts, ino) < 0) return -1;
-
-    /* Figure out how many levels there are in the tree now.
-     */
+static uint treedisk_nlevels(block_no nblocks) {
     uint nlevels = 0;
-    if (snapshot->inode->nblocks > 0)
-        while (log_shift_r(snapshot->inode->nblocks - 1, nlevels * log_rpb) !=
-               0) {
+    if (nblocks > 0)
+        while (log_shift_r(nblocks - 1, nlevels * log_rpb) != 0) {
             nlevels++;
         }
+    return nlevels;
+}
+
+/* Make the file at least 'nblocks' long, and return the number of levels in
+ * its tree.  Files cannot shrink by growing.
+ */
+static uint treedisk_grow(struct treedisk_state* ts,
+                          struct treedisk_snapshot* snapshot,
+                          block_no nblocks) {
+    uint dirty_inode = 0;
 
-    /* Figure out how many levels we need after writing.  Files cannot shrink
-     * by writing.
+    /* Figure out how many levels there are in the tree now, and how many
+     * we need after growing.
      */
-    uint nlevels_after;
-    if (offset >= snapshot->inode->nblocks) {
-        snapshot->inode->nblocks = offset + 1;
+    uint nlevels       = treedisk_nlevels(snapshot->inode->nblocks);
+    uint nlevels_after = nlevels;
+    if (nblocks > snapshot->inode->nblocks) {
+        nlevels_after = treedisk_nlevels(nblocks);
+        if (snapshot->inode->nblocks == 0) nlevels = nlevels_after;
+        snapshot->inode->nblocks = nblocks;
         dirty_inode              = 1;
-        nlevels_after            = 0;
-        while (log_shift_r(offset, nlevels_after * log_rpb) != 0) {
-            nlevels_after++;
-        }
-    } else {
-        nlevels_after = nlevels;
     }
 
     /* Grow the number of levels as needed by inserting indirect blocks.
      */
-    if (snapshot->inode->nblocks == 0) {
-        nlevels = nlevels_after;
-    } else if (nlevels_after > nlevels) {
-        while (nlevels_after > nlevels) {
-            block_no indir = treedisk_alloc_block(ts, snapshot);
-
-            /* Insert the new indirect block into the inode.
-             */
-            struct treedisk_indirblock tib;
-            memset(&tib, 0, BLOCK_SIZE);
-            tib.refs[0]           = snapshot->inode->root;
-            snapshot->inode->root = indir;
-            dirty_inode           = 1;
-            if ((*ts->below->write)(ts->below, ts->below_ino, indir,
-                                    (block_t*)&tib) < 0) {
-                panic("treedisk_write: indirect block");
-            }
+    while (nlevels_after > nlevels) {
+        block_no indir = treedisk_alloc_block(ts, ts->alloc_next);
 
-            nlevels++;
+        /* Insert the new indirect block into the inode.
+         */
+        struct treedisk_indirblock tib;
+        memset(&tib, 0, BLOCK_SIZE);
+        tib.refs[0]           = snapshot->inode->root;
+        snapshot->inode->root = indir;
+        if ((*ts->below->write)(ts->below, ts->below_ino, indir,
+                                (block_t*)&tib) < 0) {
+            panic("treedisk_write: indirect block");
         }
+
+        nlevels++;
     }
 
     /* If the inode block was updated, write it back now.
@@ -295,47 +518,145 @@ static int treedisk_write(inode_intf self, uint ino, block_no offset,
     if (dirty_inode)
         if ((*ts->below->write)(ts->below, ts->below_ino,
                                 snapshot->inode_blockno,
-                                (block_t*)&snapshot->inodeblock) < 0) {
+                                (block_t*)snapshot->inodeblock) < 0) {
             panic("treedisk_write: inode block");
         }
+    return nlevels;
+}
+
+/* Write 'nblocks' blocks from blocks[] at the given block number 'offset',
+ * passing every run of contiguous blocks below to one inode_writev().
+ */
+static int treedisk_writev(inode_intf self, uint ino, block_no offset,
+                           uint nblocks, block_t* blocks) {
+    struct treedisk_state* ts = self->state;
+    if (nblocks == 0) return 0;
 
-    /* Find the block by walking the tree, allocating new blocks
-     * (and indirect blocks) if necessary.
+    /* Get info from underlying file system.
      */
-    block_no b;
-    block_no* parent_no   = &snapshot->inode->root;
-    block_no parent_off   = snapshot->inode_blockno;
-    block_t* parent_block = (block_t*)&snapshot->inodeblock;
-    for (;;) {
-        /* Get or allocate the next block.
-         */
-        struct treedisk_indirblock tib;
-        if ((b = *parent_no) == 0) {
-            b = *parent_no = treedisk_alloc_block(ts, snapshot);
-            if ((*ts->below->write)(ts->below, ts->below_ino, parent_off,
-                                    parent_block) < 0)
-                panic("treedisk_write: parent");
-            if (nlevels == 0) break;
-            memset(&tib, 0, BLOCK_SIZE);
-        } else {
-            if (nlevels == 0) break;
-            if ((*ts->below->read)(ts->below, ts->below_ino, b,
-                                   (block_t*)&tib) < 0)
-                panic("treedisk_write");
+    struct treedisk_snapshot snapshot_buffer;
+    struct treedisk_snapshot* snapshot = &snapshot_buffer;
+    if (treedisk_get_snapshot(snapshot, ts, ino) < 0) return -1;
+
+    uint nlevels = treedisk_grow(ts, snapshot, offset + nblocks);
+
+    /* Find or allocate the blocks, and write them in runs.
+     */
+    struct treedisk_cursor* cursor = treedisk_get_cursor(ts, ino);
+    block_no run_start             = 0;
+    uint run_len                   = 0;
+    for (uint i = 0; i <= nblocks; i++) {
+        block_no b = 0;
+        if (i < nblocks)
+            b = treedisk_alloc_path(ts, snapshot, cursor, nlevels, offset + i);
+
+        if (run_len > 0 && (i == nblocks || b != run_start + run_len)) {
+            if (inode_writev(ts->below, ts->below_ino, run_start, run_len,
+                             &blocks[i - run_len]) < 0)
+                panic("treedisk_write: data block");
+            run_len = 0;
         }
+        if (i < nblocks && run_len++ == 0) run_start = b;
+    }
 
-        /* Figure out the index into this block and get the block number.
+    treedisk_flush_cursor(ts, cursor);
+    treedisk_sync_bitmap(ts);
+    return 0;
+}
+
+/* Write *block at the given block number 'offset'.
+ */
+static int treedisk_write(inode_intf self, uint ino, block_no offset,
+                          block_t* block) {
+    return treedisk_writev(self, ino, offset, 1, block);
+}
+
+/* Free the blocks in the subtree rooted at block b of the given height which
+ * hold the blocks from 'first' on, counted from the start of the subtree,
+ * and block b itself if 'first' is 0.  Only the indirect blocks are read,
+ * and the bitmap is written once by the caller.
+ */
+static void treedisk_free_tree(struct treedisk_state* ts, block_no b,
+                               uint height, block_no first) {
+    if (b == 0) return;
+
+    if (height > 0) {
+        union treedisk_block tib;
+        if ((*ts->below->read)(ts->below, ts->below_ino, b,
+                               (block_t*)&tib) < 0)
+            panic("treedisk_free_tree");
+
+        /* Child i holds the blocks from i * span on.
          */
-        nlevels--;
-        uint index   = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
-        parent_no    = &tib.refs[index];
-        parent_block = (block_t*)&tib;
-        parent_off   = b;
+        uint shift     = (height - 1) * log_rpb;
+        block_no index = log_shift_r(first, shift);
+        block_no rest  = first - (index << shift);
+        uint dirty     = 0;
+        for (block_no i = index; i < REFS_PER_BLOCK; i++) {
+            block_no child_first = (i == index) ? rest : 0;
+            treedisk_free_tree(ts, tib.indirblock.refs[i], height - 1,
+                               child_first);
+            if (child_first == 0 && tib.indirblock.refs[i] != 0) {
+                tib.indirblock.refs[i] = 0;
+                dirty                  = 1;
+            }
+        }
+
+        if (first > 0 && dirty &&
+            (*ts->below->write)(ts->below, ts->below_ino, b,
+                                (block_t*)&tib) < 0)
+            panic("treedisk_free_tree: indirect block");
     }
 
-    if ((*ts->below->write)(ts->below, ts->below_ino, b, block) < 0)
-        panic("treedisk_write: data block");
-    return 0;
+    if (first == 0) treedisk_mark_block(ts, b, 0);
+}
+
+/* Set the size of the file to 'nblocks' and return the old size.  Growing
+ * a file leaves a hole, and shrinking it frees the blocks past the end.
+ */
+static int treedisk_setsize(inode_intf self, uint ino, block_no nblocks) {
+    struct treedisk_state* ts = self->state;
+
+    struct treedisk_snapshot snapshot;
+    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0) return -1;
+
+    struct treedisk_inode* inode = snapshot.inode;
+    block_no old_nblocks         = inode->nblocks;
+    if (nblocks >= old_nblocks) {
+        /* The new levels of the tree are allocated in the bitmap. */
+        treedisk_grow(ts, &snapshot, nblocks);
+        treedisk_sync_bitmap(ts);
+        return old_nblocks;
+    }
+
+    /* The freed blocks may be allocated again, so forget the cursor.
+     */
+    struct treedisk_cursor* cursor = treedisk_get_cursor(ts, ino);
+    memset(cursor->path_nos, 0, sizeof(cursor->path_nos));
+
+    uint nlevels = treedisk_nlevels(old_nblocks);
+    treedisk_free_tree(ts, inode->root, nlevels, nblocks);
+    if (nblocks == 0) inode->root = 0;
+
+    /* Take away the levels of the tree which are not needed anymore.  The
+     * blocks left are all under the first reference of the root.
+     */
+    for (; nblocks > 0 && nlevels > treedisk_nlevels(nblocks); nlevels--) {
+        union treedisk_block tib;
+        if (inode->root == 0) continue;
+        if ((*ts->below->read)(ts->below, ts->below_ino, inode->root,
+                               (block_t*)&tib) < 0)
+            panic("treedisk_setsize");
+        treedisk_mark_block(ts, inode->root, 0);
+        inode->root = tib.indirblock.refs[0];
+    }
+
+    inode->nblocks = nblocks;
+    if ((*ts->below->write)(ts->below, ts->below_ino, snapshot.inode_blockno,
+                            (block_t*)snapshot.inodeblock) < 0)
+        panic("treedisk_setsize: inode block");
+    treedisk_sync_bitmap(ts);
+    return old_nblocks;
 }
 
 /* Open a virtual inode store on the specified inode of the inode store below.
@@ -366,6 +687,8 @@ inode_intf treedisk_init(inode_intf below, uint below_ino) {
     self->setsize = treedisk_setsize;
     self->read    = treedisk_read;
     self->write   = treedisk_write;
+    self->readv   = treedisk_readv;
+    self->writev  = treedisk_writev;
     return self;
 }
 
@@ -374,28 +697,28 @@ inode_intf treedisk_init(inode_intf below, uint below_ino) {
  * only be invoked once per underlying inode store.
  ************************************************************************/
 
-/* Create the free list and return the block number of the first
- * block on it.
+/* Create the free bitmap of a file system with 'nblocks' blocks and return
+ * the number of bitmap blocks, which follow the inode blocks.
  */
-block_no setup_freelist(inode_intf below, uint below_ino, block_no next_free,
-                        block_no nblocks) {
-    block_no freelist_data[REFS_PER_BLOCK];
-    block_no freelist_block = 0;
-    uint i;
-
-    while (next_free < nblocks) {
-        freelist_data[0] = freelist_block;
-        freelist_block   = next_free++;
-        for (i = 1; i < REFS_PER_BLOCK && next_free < nblocks; i++)
-            freelist_data[i] = next_free++;
-
-        for (; i < REFS_PER_BLOCK; i++) freelist_data[i] = 0;
-
-        if ((*below->write)(below, below_ino, freelist_block,
-                            (block_t*)freelist_data) < 0)
-            panic("treedisk_setup_freelist");
+static block_no setup_bitmap(inode_intf below, uint below_ino,
+                             block_no n_inodeblocks, block_no nblocks) {
+    block_no n_bitmapblocks = (nblocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    block_no first          = 1 + n_inodeblocks + n_bitmapblocks;
+
+    for (block_no i = 0; i < n_bitmapblocks; i++) {
+        union treedisk_block bitmapblock;
+        memset(&bitmapblock, 0, BLOCK_SIZE);
+        for (block_no j = 0; j < BITS_PER_BLOCK; j++) {
+            block_no b = i * BITS_PER_BLOCK + j;
+            if (b < first || b >= nblocks)
+                bitmapblock.bitmapblock.bits[j / 8] |= 1 << (j % 8);
+        }
+
+        if ((*below->write)(below, below_ino, 1 + n_inodeblocks + i,
+                            (block_t*)&bitmapblock) < 0)
+            panic("treedisk_setup_bitmap");
     }
-    return freelist_block;
+    return n_bitmapblocks;
 }
 
 /* Create a new file system on the specified inode of the inode store below.
@@ -411,8 +734,9 @@ int treedisk_create(inode_intf below, uint below_ino, uint ninodes) {
 
     /* Get the size of the underlying disk and see if it's large enough.
      */
-    uint nblocks = (*below->getsize)(below, below_ino);
-    if (nblocks < n_inodeblocks + 2) {
+    uint nblocks        = (*below->getsize)(below, below_ino);
+    uint n_bitmapblocks = (nblocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+    if (nblocks < n_inodeblocks + n_bitmapblocks + 2) {
         printf("treedisk_create: too few blocks\n");
         return -1;
     }
@@ -429,8 +753,9 @@ int treedisk_create(inode_intf below, uint below_ino, uint ninodes) {
         union treedisk_block superblock;
         memset(&superblock, 0, BLOCK_SIZE);
         superblock.superblock.n_inodeblocks = n_inodeblocks;
-        superblock.superblock.free_list =
-            setup_freelist(below, below_ino, n_inodeblocks + 1, nblocks);
+        superblock.superblock.nblocks       = nblocks;
+        superblock.superblock.n_bitmapblocks =
+            setup_bitmap(below, below_ino, n_inodeblocks, nblocks);
         if ((*below->write)(below, below_ino, 0, (block_t*)&superblock) < 0)
             return -1;
 
@@ -9,8 +9,10 @@
  * a virtualized inode store.  Each virtualized file is identified by a
  * so-called "inode number", which indexes into an array of inodes.
  *
- * The superblock maintains the number of inode blocks and a pointer
- * to the free list structure.
+ * The superblock maintains the number of inode blocks, the number of
+ * blocks of the free bitmap, and the number of blocks in the file system.
+ * Block 0 is the superblock, the inode blocks follow, then the bitmap
+ * blocks, and the remaining blocks hold data and indirect blocks.
  *
  * An inode block is filled with INODES_PER_BLOCK inodes.  Data in the
  * inode is stored in a complete tree, with the branching vector determined
@@ -25,10 +27,10 @@
  * exist both for data and indirect blocks.  Reading from a hole returns
  * null bytes.
  *
- * The free list is a linked list of blocks.  Each block is filled with
- * block indices, the first of which is either 0 to indicate the end of
- * the list, or otherwise a pointer to the next block on the list.  The
- * remaining slots point to free blocks, or 0 if the slot is empty.
+ * The free bitmap has one bit for every block in the file system, which
+ * is 1 if the block is in use.  Bit i of byte j is for block 8 * j + i.
+ * The bits of the superblock, the inode blocks, the bitmap blocks, and
+ * the nonexistent blocks past the end of the file system are always 1.
  */
 #pragma once
 #include "inode.h"
@@ -36,12 +38,14 @@
 typedef unsigned int block_no; /* index of a block */
 #define REFS_PER_BLOCK   (BLOCK_SIZE / sizeof(block_no))
 #define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(struct treedisk_inode))
+#define BITS_PER_BLOCK   (BLOCK_SIZE * 8)
 
 /* Contents of the "superblock".  There is only one of these.
  */
 struct treedisk_superblock {
-    block_no n_inodeblocks; /* # blocks with inodes */
-    block_no free_list;     /* pointer to first block on free list */
+    block_no n_inodeblocks;  /* # blocks with inodes */
+    block_no n_bitmapblocks; /* # blocks of the free bitmap */
+    block_no nblocks;        /* # blocks in the file system */
 };
 
 /* An inode describes a file (= virtual inode store).  "nblocks" contains
@@ -61,12 +65,10 @@ struct treedisk_inodeblock {
     struct treedisk_inode inodes[INODES_PER_BLOCK];
 };
 
-/* A freelist block is filled with references to other blocks, the first
- * one of which is the next freelist block (0 = end-of-list). Remember that
- * the freelist acts as a stack (freelist blocks are added FILO).
+/* A bitmap block holds the bits of BITS_PER_BLOCK consecutive blocks.
  */
-struct treedisk_freelistblock {
-    block_no refs[REFS_PER_BLOCK];
+struct treedisk_bitmapblock {
+    unsigned char bits[BLOCK_SIZE];
 };
 
 /* An indirect block is an internal node in the tree rooted at an inode.
@@ -82,6 +84,6 @@ union treedisk_block {
     block_t datablock;
     struct treedisk_superblock superblock;
     struct treedisk_inodeblock inodeblock;
-    struct treedisk_freelistblock freelistblock;
+    struct treedisk_bitmapblock bitmapblock;
     struct treedisk_indirblock indirblock;
 };
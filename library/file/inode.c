@@ -0,0 +1,34 @@
+/*
+ * (C) 2026, Cornell University
+ * All rights reserved.
+ *
+ * Description: multi-block access to any inode store
+ * Use the readv or writev method of an inode store if it has one, or else
+ * read or write the blocks one at a time (see inode.h).
+ */
+
+#ifdef MKFS
+#include <sys/types.h>
+#else
+#include "egos.h"
+#endif
+
+#include "inode.h"
+
+int inode_readv(inode_intf self, uint ino, uint offset, uint nblocks,
+                block_t* blocks) {
+    if (self->readv) return self->readv(self, ino, offset, nblocks, blocks);
+
+    for (uint i = 0; i < nblocks; i++)
+        if (self->read(self, ino, offset + i, &blocks[i]) < 0) return -1;
+    return 0;
+}
+
+int inode_writev(inode_intf self, uint ino, uint offset, uint nblocks,
+                 block_t* blocks) {
+    if (self->writev) return self->writev(self, ino, offset, nblocks, blocks);
+
+    for (uint i = 0; i < nblocks; i++)
+        if (self->write(self, ino, offset + i, &blocks[i]) < 0) return -1;
+    return 0;
+}
@@ -26,6 +26,15 @@
  * int write(inode_intf self, unsigned int ino, uint offset, block_t *block)
  *   - writes *block to the block at the given inode number and offset
  *
+ * int readv(inode_intf self, unsigned int ino, uint offset, uint nblocks,
+ *           block_t *blocks)
+ * int writev(inode_intf self, unsigned int ino, uint offset, uint nblocks,
+ *            block_t *blocks)
+ *   - read or write nblocks consecutive blocks starting at offset, so that
+ *     contiguous blocks can reach the disk with one multi-block command;
+ *     an inode store may leave them NULL, and callers use inode_readv()
+ *     and inode_writev() which fall back to one block at a time
+ *
  * All these return -1 upon error (typically after printing the eason for
  * the error) and return 0 upon success.
  *
@@ -44,9 +53,18 @@ struct inode_store {
     int (*setsize)(inode_intf self, uint ino, uint newsize);
     int (*read)(inode_intf self, uint ino, uint offset, block_t* block);
     int (*write)(inode_intf self, uint ino, uint offset, block_t* block);
+    int (*readv)(inode_intf self, uint ino, uint offset, uint nblocks,
+                 block_t* blocks);
+    int (*writev)(inode_intf self, uint ino, uint offset, uint nblocks,
+                  block_t* blocks);
     void* state;
 };
 
+int inode_readv(inode_intf self, uint ino, uint offset, uint nblocks,
+                block_t* blocks);
+int inode_writev(inode_intf self, uint ino, uint offset, uint nblocks,
+                 block_t* blocks);
+
 /* There are 2 file systems in egos-2000 right now: mydisk and treedisk. */
 inode_intf mydisk_init(inode_intf below, uint below_ino);
 int mydisk_create(inode_intf below, uint below_ino, uint ninodes);
@@ -2,26 +2,209 @@
  * (C) 2026, Cornell University
  * All rights reserved.
  *
- * Description: system support for C library function malloc()
+ * Description: memory allocator for C library functions malloc() and free()
+ * Small objects come from size classes, and every page (span) of a class
+ * holds objects of the same size; a larger object takes a run of whole pages.
+ * Pages are carved from the heap region like a bump arena, and user apps
+ * return the pages which become free to the kernel in batches.
  */
 
 #include "egos.h"
+#include "servers.h"
+#include <stddef.h>
+#include <string.h>
 
 /* Heap start and end are defined in library/elf/{egos/app}.lds. */
 extern char __heap_start, __heap_end;
-static char* brk = &__heap_start;
 
-/* malloc() and free() are linked from the compiler's C library;
- * malloc() and free() manage the memory region [&__heap_start, brk).
- * If malloc() finds it too small, it will call _sbrk() to increase brk. */
+#define PAGE_SIZE  4096
+#define MIN_SIZE   16
+#define NCLASS     8 /* 16, 32, ..., 2048 bytes */
+#define SPAN_FREE  0
+#define SPAN_IDLE  0xFE /* A free page which is still mapped. */
+#define SPAN_LARGE 0xFF /* Other spans hold size class + 1. */
 
-char* _sbrk(int size) {
-    if (brk + size > (char*)&__heap_end) {
-        printf("_sbrk: heap grows too large\n\r");
-        *(int*)(0) = 1; /* Trigger a memory exception. */
+/* An app keeps up to HEAP_IDLE_MAX free pages mapped for later malloc(),
+ * and then returns all its free pages to the kernel with one unmap() for
+ * every run of adjacent pages, rather than one unmap() for every free(). */
+#define HEAP_IDLE_MAX 16
+
+/* The heap ends before APPS_ARG in an app and before EARTH_STRUCT in the
+ * kernel, so it is never larger than the code and data region before it. */
+#define APPS_HEAP_NBYTES (APPS_ARG - APPS_ENTRY)
+#define EGOS_HEAP_NBYTES (EARTH_STRUCT - RAM_START)
+#define HEAP_NPAGES                                                            \
+    ((APPS_HEAP_NBYTES > EGOS_HEAP_NBYTES ? APPS_HEAP_NBYTES                   \
+                                          : EGOS_HEAP_NBYTES) /                \
+     PAGE_SIZE)
+
+/* Side table of the heap pages, indexed by page number in the heap. */
+static struct span {
+    uchar class;  /* SPAN_FREE/IDLE/LARGE, or a size class + 1 */
+    uchar npages; /* number of pages in a large span */
+    ushort nused; /* number of objects in use in a small span */
+    ushort bump;  /* offset of the first never-used object in a small span */
+    ushort next;  /* next small span of the class with room, plus 1 */
+    void* free;   /* objects freed in a small span */
+} span[HEAP_NPAGES];
+
+static char* heap_base; /* &__heap_start rounded up to a page */
+static uint heap_npages, heap_top, heap_nidle;
+static ushort partial[NCLASS]; /* first span of each class with room, plus 1 */
+
+#define PAGE_ADDR(i)  (heap_base + (i) * PAGE_SIZE)
+#define CLASS_SIZE(c) (MIN_SIZE << (c))
+
+static void heap_init() {
+    heap_base   = (char*)(((uint)&__heap_start + PAGE_SIZE - 1) &
+                        ~(PAGE_SIZE - 1));
+    heap_npages = ((uint)&__heap_end - (uint)heap_base) / PAGE_SIZE;
+    if (heap_npages > HEAP_NPAGES) heap_npages = HEAP_NPAGES;
+}
+
+#define SPAN_UNUSED(i)                                                         \
+    (span[i].class == SPAN_FREE || span[i].class == SPAN_IDLE)
+
+static int page_alloc(uint npages) {
+    /* Reuse free pages below heap_top, or take new pages at heap_top. */
+    int first = -1;
+    for (uint i = 0, run = 0; i < heap_top && first < 0; i++) {
+        run = SPAN_UNUSED(i) ? run + 1 : 0;
+        if (run == npages) first = i + 1 - npages;
+    }
+    if (first < 0) {
+        if (heap_top + npages > heap_npages) return -1;
+        first = heap_top;
+        heap_top += npages;
+    }
+
+    for (uint i = first; i < first + npages; i++)
+        if (span[i].class == SPAN_IDLE) heap_nidle--;
+    return first;
+}
+
+static void page_free(uint first, uint npages) {
+    memset(&span[first], 0, npages * sizeof(struct span));
+    while (heap_top && SPAN_UNUSED(heap_top - 1)) heap_top--;
+#ifndef KERNEL
+    for (uint i = first; i < first + npages; i++) span[i].class = SPAN_IDLE;
+    if ((heap_nidle += npages) <= HEAP_IDLE_MAX) return;
+
+    /* The kernel maps zeroed pages again upon the next access. */
+    for (uint i = 0, run = 0; i <= heap_npages; i++) {
+        if (i < heap_npages && span[i].class == SPAN_IDLE) {
+            span[i].class = SPAN_FREE;
+            run++;
+        } else if (run) {
+            unmap(PAGE_ADDR(i - run), run);
+            run = 0;
+        }
+    }
+    heap_nidle = 0;
+#endif
+}
+
+static void* large_alloc(size_t size) {
+    uint npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    int first   = (npages < HEAP_NPAGES) ? page_alloc(npages) : -1;
+    if (first < 0) return NULL;
+
+    for (uint i = first; i < first + npages; i++) span[i].class = SPAN_LARGE;
+    span[first].npages = npages;
+    return PAGE_ADDR(first);
+}
+
+void* malloc(size_t size) {
+    if (!heap_base) heap_init();
+    if (size > CLASS_SIZE(NCLASS - 1)) return large_alloc(size);
+
+    uint class = 0;
+    while (CLASS_SIZE(class) < size) class++;
+
+    if (!partial[class]) {
+        int page = page_alloc(1);
+        if (page < 0) return NULL;
+        span[page].class = class + 1;
+        partial[class]   = page + 1;
+    }
+
+    /* Take a freed object, or else the next never-used object. */
+    uint page      = partial[class] - 1;
+    struct span* s = &span[page];
+    void* obj      = s->free;
+    if (obj) {
+        s->free = *(void**)obj;
+    } else {
+        obj = PAGE_ADDR(page) + s->bump;
+        s->bump += CLASS_SIZE(class);
     }
+    s->nused++;
+
+    if (!s->free && s->bump + CLASS_SIZE(class) > PAGE_SIZE) {
+        /* The span is full, so take it off the partial list. */
+        partial[class] = s->next;
+        s->next        = 0;
+    }
+    return obj;
+}
+
+void free(void* ptr) {
+    uint page = ((uint)ptr - (uint)heap_base) / PAGE_SIZE;
+    if (!ptr || (char*)ptr < heap_base || page >= heap_npages) return;
+
+    struct span* s = &span[page];
+    if (s->class == SPAN_LARGE) return page_free(page, s->npages);
+    if (SPAN_UNUSED(page)) return;
+
+    uint class = s->class - 1;
+    if (!s->free && s->bump + CLASS_SIZE(class) > PAGE_SIZE) {
+        /* The span was full, so put it back on the partial list. */
+        s->next        = partial[class];
+        partial[class] = page + 1;
+    }
+    *(void**)ptr = s->free;
+    s->free      = ptr;
+
+    /* Keep the first span of the class, so that a loop of malloc() and
+     * free() does not return and fault in the same page every time. */
+    if (--s->nused || partial[class] == page + 1) return;
+
+    ushort* prev = &partial[class];
+    while (*prev != page + 1) prev = &span[*prev - 1].next;
+    *prev = s->next;
+    page_free(page, 1);
+}
+
+static size_t usable_size(void* ptr) {
+    struct span* s = &span[((uint)ptr - (uint)heap_base) / PAGE_SIZE];
+    return (s->class == SPAN_LARGE) ? s->npages * PAGE_SIZE
+                                    : CLASS_SIZE(s->class - 1);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (size && n > (size_t)-1 / size) return NULL;
+    void* ptr = malloc(n * size);
+    if (ptr) memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (size <= usable_size(ptr)) return ptr;
+
+    void* new_ptr = malloc(size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, usable_size(ptr));
+        free(ptr);
+    }
+    return new_ptr;
+}
 
-    char* old_brk = brk;
-    brk += size;
-    return old_brk;
+/* The compiler's C library calls the reentrant versions internally, so
+ * redirect them here instead of linking its own allocator. */
+void* _malloc_r(void* reent, size_t size) { return malloc(size); }
+void _free_r(void* reent, void* ptr) { free(ptr); }
+void* _calloc_r(void* reent, size_t n, size_t size) { return calloc(n, size); }
+void* _realloc_r(void* reent, void* ptr, size_t size) {
+    return realloc(ptr, size);
 }
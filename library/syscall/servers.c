@@ -12,6 +12,28 @@
 static int sender;
 static char buf[SYSCALL_MSG_LEN];
 
+int fork() {
+    struct proc_request req;
+    struct proc_reply reply;
+    req.type = PROC_FORK;
+    sys_send(GPID_PROCESS, (void*)&req, sizeof(req));
+    sys_recv(GPID_PROCESS, NULL, (void*)&reply, sizeof(reply));
+
+    /* The parent receives the pid of the child, and the child receives 0. */
+    return reply.type == CMD_OK ? reply.pid : -1;
+}
+
+void unmap(void* addr, uint npages) {
+    struct proc_request req;
+    struct proc_reply reply;
+    req.type   = PROC_UNMAP;
+    req.addr   = (uint)addr;
+    req.npages = npages;
+    sys_send(GPID_PROCESS, (void*)&req, sizeof(req));
+    /* Wait for the reply, so the pages are unmapped before being reused. */
+    sys_recv(GPID_PROCESS, NULL, (void*)&reply, sizeof(reply));
+}
+
 void exit(int status) {
     struct proc_request req;
     req.type = PROC_EXIT;
@@ -29,17 +51,15 @@ void sleep(uint usec) {
     /* Student's code ends here. */
 }
 
-int dir_lookup(int dir_ino, char* name) {
-    char buf[BLOCK_SIZE];
-    file_read(dir_ino, 0, buf);
-
-    /* Read tools/mkfs.c to understand directory management. */
-    for (uint i = 0, namelen = strlen(name); i < strlen(buf) - namelen; i++)
-        if (!strncmp(name, buf + i, namelen) && buf[i + namelen] == ' ' &&
-            (i == 0 || buf[i - 1] == ' '))
-            return atoi(buf + i + namelen);
-
-    return -1;
+static void cache_drop(int file_ino) {
+    /* GPID_PROCESS drops the executable pages cached for the file between
+     * two spawns, so that the next spawn reads the file again. */
+    struct proc_request req;
+    struct proc_reply reply;
+    req.type = PROC_CACHE_DROP;
+    req.ino  = file_ino;
+    sys_send(GPID_PROCESS, (void*)&req, sizeof(req));
+    sys_recv(GPID_PROCESS, NULL, (void*)&reply, sizeof(reply));
 }
 
 int file_read(int file_ino, uint offset, char* block) {
@@ -57,6 +77,68 @@ int file_read(int file_ino, uint offset, char* block) {
     return reply->status == FILE_OK ? 0 : -1;
 }
 
+int file_write(int file_ino, uint offset, char* block) {
+    /* GPID_FILE replies once the block is in its write-back cache, and
+     * file_flush() returns after the block has been written to the disk. */
+    struct file_request req;
+    req.type   = FILE_WRITE;
+    req.ino    = file_ino;
+    req.offset = offset;
+    memcpy(req.block.bytes, block, BLOCK_SIZE);
+
+    sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    sys_recv(GPID_FILE, &sender, buf, SYSCALL_MSG_LEN);
+
+    struct file_reply* reply = (void*)buf;
+    if (reply->status != FILE_OK) return -1;
+    cache_drop(file_ino);
+    return 0;
+}
+
+int file_setsize(int file_ino, uint nblocks) {
+    /* Grow the file with null blocks, or truncate it to nblocks blocks. */
+    struct file_request req;
+    req.type   = FILE_SETSIZE;
+    req.ino    = file_ino;
+    req.offset = nblocks;
+
+    sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    sys_recv(GPID_FILE, &sender, buf, SYSCALL_MSG_LEN);
+
+    struct file_reply* reply = (void*)buf;
+    if (reply->status != FILE_OK) return -1;
+    cache_drop(file_ino);
+    return 0;
+}
+
+int file_lookup(int dir_ino, char* path) {
+    /* GPID_FILE resolves the path from dir_ino, or from / if it starts
+     * with a '/', and replies the inode number. */
+    struct file_request req;
+    req.type = FILE_LOOKUP;
+    req.ino  = dir_ino;
+    strncpy(req.block.bytes, path, BLOCK_SIZE - 1);
+    req.block.bytes[BLOCK_SIZE - 1] = 0;
+
+    sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    sys_recv(GPID_FILE, &sender, buf, SYSCALL_MSG_LEN);
+
+    struct file_reply* reply = (void*)buf;
+    return reply->status == FILE_OK ? reply->ino : -1;
+}
+
+int file_flush() {
+    /* Write the dirty blocks cached by GPID_FILE back to the disk. */
+    struct file_request req;
+    req.type = FILE_FLUSH;
+
+    sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    sys_recv(GPID_FILE, &sender, buf, SYSCALL_MSG_LEN);
+
+    struct file_reply* reply = (void*)buf;
+    return reply->status == FILE_OK ? 0 : -1;
+}
+
 #ifndef KERNEL
 
 /* Terminal read/write for user apps to send messages to GPID_TERMINAL. */
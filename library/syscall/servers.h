@@ -1,11 +1,16 @@
 #pragma once
 
+int fork();
 void exit(int status);
+void unmap(void* addr, uint npages);
 void sleep(uint usec);
 int term_read(char* buf, uint len);
 void term_write(char* str, uint len);
-int dir_lookup(int dir_ino, char* name);
 int file_read(int file_ino, uint offset, char* block);
+int file_write(int file_ino, uint offset, char* block);
+int file_setsize(int file_ino, uint nblocks);
+int file_lookup(int dir_ino, char* path);
+int file_flush();
 
 enum grass_servers {
     GPID_ALL = -1,
@@ -25,14 +30,24 @@ struct proc_request {
     /* Student's code goes here (System Call & Protection). */
 
     /* Update struct proc_request for process sleep. */
-    enum { PROC_SPAWN, PROC_EXIT, PROC_KILLALL } type;
+    enum {
+        PROC_SPAWN,
+        PROC_FORK,
+        PROC_UNMAP,
+        PROC_EXIT,
+        PROC_KILLALL,
+        PROC_CACHE_DROP,
+    } type;
     int argc;
     char argv[CMD_NARGS][CMD_ARG_LEN];
+    uint addr, npages; /* for PROC_UNMAP */
+    int ino;           /* for PROC_CACHE_DROP */
     /* Student's code ends here. */
 };
 
 struct proc_reply {
     enum { CMD_OK, CMD_ERROR } type;
+    int pid; /* for PROC_FORK */
 };
 
 /* GPID_TERMINAL */
@@ -55,13 +70,17 @@ struct file_request {
         FILE_UNUSED,
         FILE_READ,
         FILE_WRITE,
+        FILE_FLUSH,
+        FILE_LOOKUP,
+        FILE_SETSIZE,
     } type;
     uint ino;
-    uint offset;
+    uint offset; /* or the number of blocks for FILE_SETSIZE */
     block_t block;
 };
 
 struct file_reply {
     enum file_status { FILE_OK, FILE_ERROR } status;
     block_t block;
+    int ino; /* for FILE_LOOKUP */
 };
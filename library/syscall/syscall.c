@@ -24,3 +24,22 @@ void sys_recv(int from, int* sender, char* buf, uint size) {
     memcpy(buf, sc->content, size);
     if (sender) *sender = sc->sender;
 }
+
+void sys_disk_submit(struct disk_request* req) {
+    /* The kernel keeps a copy of the request and of its address req, and
+     * the device serves it in the background (see grass/kernel.c). */
+    sc->type = SYS_DISK_SUBMIT;
+    memcpy(sc->content, &req, sizeof(req));
+    memcpy(sc->content + sizeof(req), req, sizeof(*req));
+    asm("ecall");
+}
+
+struct disk_request* sys_disk_wait() {
+    /* Return a request of the caller after the device has served it. */
+    struct disk_request* req;
+    sc->type = SYS_DISK_WAIT;
+    asm("ecall");
+    memcpy(&req, sc->content, sizeof(req));
+    req->done = 1;
+    return req;
+}
@@ -4,8 +4,10 @@
 #include <string.h>
 
 enum syscall_type {
-    SYS_RECV = 1,
-    SYS_SEND = 2,
+    SYS_RECV        = 1,
+    SYS_SEND        = 2,
+    SYS_DISK_WAIT   = 3,
+    SYS_DISK_SUBMIT = 4,
 };
 
 #define SYSCALL_MSG_LEN 1024
@@ -19,3 +21,5 @@ struct syscall {
 
 void sys_send(int receiver, char* msg, uint size);
 void sys_recv(int from, int* sender, char* buf, uint size);
+void sys_disk_submit(struct disk_request* req);
+struct disk_request* sys_disk_wait();
@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "inode.h"
+#include "dir.h"
 
 char* egos_binaries[] = {"./egos.bin",
                          "../build/release/sys_proc.elf",
@@ -33,8 +34,8 @@ char* egos_binaries[] = {"./egos.bin",
                          "./images/Bohr.bmp" /* for the video demo app */};
 #define EGOS_BIN_NUM ((sizeof(egos_binaries) / sizeof(char*)))
 
-char bin_dir[256] = "./   6 ../   0 ";
-char* contents[]  = {
+char bin_dir[4096] = "./   6 ../   0 ";
+char* contents[]   = {
     "./   0 ../   0 home/   1 bin/   6 ",
     "./   1 ../   0 yunhao/   2 rvr/   3 yacqub/   4 ",
     "./   2 ../   1 README   5 ",
@@ -66,28 +67,69 @@ int getsize(inode_intf bs, uint ino) { return FILE_SYS_DISK_SIZE / BLOCK_SIZE; }
 
 int setsize(inode_intf bs, uint ino, uint newsize) { assert(0); }
 
+/* Count the requests to the ramdisk to compare the file systems. */
+uint nrequests, nblocks;
+
 int ramread(inode_intf bs, uint ino, uint offset, block_t* block) {
+    nrequests++, nblocks++;
     memcpy(block, fs + offset * BLOCK_SIZE, BLOCK_SIZE);
     return 0;
 }
 
 int ramwrite(inode_intf bs, uint ino, uint offset, block_t* block) {
+    nrequests++, nblocks++;
     memcpy(fs + offset * BLOCK_SIZE, block, BLOCK_SIZE);
     return 0;
 }
 
+int ramreadv(inode_intf bs, uint ino, uint offset, uint n, block_t* blocks) {
+    nrequests++, nblocks += n;
+    memcpy(blocks, fs + offset * BLOCK_SIZE, n * BLOCK_SIZE);
+    return 0;
+}
+
+int ramwritev(inode_intf bs, uint ino, uint offset, uint n, block_t* blocks) {
+    nrequests++, nblocks += n;
+    memcpy(fs + offset * BLOCK_SIZE, blocks, n * BLOCK_SIZE);
+    return 0;
+}
+
+/* Write a directory given as "name ino " pairs in the hashed format (see
+ * library/file/dir.h), with a table at most half full. */
+void write_dir(inode_intf filesys, uint dir_ino, char* pairs) {
+    char name[DIR_NAME_LEN];
+    uint ino, nentries = 0, nblocks = 1;
+    for (int i = 0, n; sscanf(pairs + i, "%27s %u %n", name, &ino, &n) == 2;
+         i += n)
+        nentries++;
+    while (nblocks * DIR_PER_BLOCK - 1 < 2 * nentries) nblocks++;
+
+    struct dir_entry* slots    = calloc(nblocks, BLOCK_SIZE);
+    *(struct dir_header*)slots = (struct dir_header){DIR_MAGIC, nblocks, 0};
+    for (int i = 0, n; sscanf(pairs + i, "%27s %u %n", name, &ino, &n) == 2;
+         i += n)
+        assert(dir_add(slots, nblocks * DIR_PER_BLOCK, name, ino) == 0);
+
+    inode_writev(filesys, dir_ino, 0, nblocks, (void*)slots);
+    free(slots);
+}
+
 int main() {
     /* Write the kernel and system server binaries into exec[]. */
     printf("[INFO] Load %ld kernel binary files\n", EGOS_BIN_NUM);
     for (uint i = 0; i < EGOS_BIN_NUM; i++) {
         int sz = load_file(egos_binaries[i], exec + i * EGOS_BIN_MAX_NBYTE);
         printf("[INFO] Load %s: %d bytes\n", egos_binaries[i], sz);
+        /* Only the last file (the image) can go beyond its slot. */
+        assert(sz <= EGOS_BIN_MAX_NBYTE || i == EGOS_BIN_NUM - 1);
     }
 
     /* Initialize the file system using the fs[] buffer as a ramdisk. */
     printf("MKFS is using *%s*\n", FILESYS == 0 ? "mydisk" : "treedisk");
     struct inode_store ramdisk = (struct inode_store){.read    = ramread,
                                                       .write   = ramwrite,
+                                                      .readv   = ramreadv,
+                                                      .writev  = ramwritev,
                                                       .getsize = getsize,
                                                       .setsize = setsize};
     (FILESYS == 0) ? assert(mydisk_create(&ramdisk, 0, NINODES) >= 0)
@@ -98,8 +140,12 @@ int main() {
     /* Write to inode 0..BIN_DIR_INODE-1 in the file system. */
     for (uint ino = 0; ino < BIN_DIR_INODE; ino++) {
         printf("[INFO] Load ino=%d, %ld bytes\n", ino, strlen(contents[ino]));
-        strncpy(inode, contents[ino], BLOCK_SIZE);
-        filesys->write(filesys, ino, 0, (void*)inode);
+        if (strncmp(contents[ino], "./", 2) == 0) {
+            write_dir(filesys, ino, contents[ino]);
+        } else {
+            strncpy(inode, contents[ino], BLOCK_SIZE);
+            filesys->write(filesys, ino, 0, (void*)inode);
+        }
     }
 
     /* Write to one inode for each user application. */
@@ -114,18 +160,28 @@ int main() {
                    file_size);
 
             /* Write the ELF format application binary into inode app_ino. */
-            for (uint b = 0; b * BLOCK_SIZE < file_size; b++)
-                filesys->write(filesys, app_ino, b,
-                               (void*)(inode + b * BLOCK_SIZE));
+            uint nblocks = (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            inode_writev(filesys, app_ino, 0, nblocks, (void*)inode);
 
             /* Add the corresponding file entry into the /bin directory. */
             ep->d_name[strlen(ep->d_name) - 4] = 0;
             sprintf(tmp, "%s%4d ", ep->d_name, app_ino++);
+            assert(strlen(bin_dir) + strlen(tmp) < sizeof(bin_dir));
             strcat(bin_dir, tmp);
         }
     closedir(dp);
-    filesys->write(filesys, BIN_DIR_INODE, 0, (void*)bin_dir);
+    write_dir(filesys, BIN_DIR_INODE, bin_dir);
     printf("[INFO] Load ino=%ld, %s\n", BIN_DIR_INODE, bin_dir);
+    printf("[INFO] Write with %d ramdisk requests for %d blocks\n", nrequests,
+           nblocks);
+
+    /* Read every application back as a sequential read of the whole file. */
+    nrequests = nblocks = 0;
+    for (uint ino = BIN_DIR_INODE + 1; ino < app_ino; ino++)
+        assert(inode_readv(filesys, ino, 0, filesys->getsize(filesys, ino),
+                           (void*)inode) >= 0);
+    printf("[INFO] Read back with %d ramdisk requests for %d blocks\n",
+           nrequests, nblocks);
 
     /* Generate the disk image file. */
     int fd  = open("disk.img", O_CREAT | O_WRONLY, 0666);